@@ -0,0 +1,137 @@
+// ACPI support
+// Find the processors and the I/O APIC in the Multiple APIC
+// Description Table, which firmware provides for machines
+// of any size, unlike the legacy MP tables (see mp.c).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "acpi.h"
+#include "mmu.h"
+#include "proc.h"
+
+#define NRSDT  32  // tables looked at in the RSDT
+
+static uchar
+sum(uchar *addr, int len)
+{
+  int i, sum;
+
+  sum = 0;
+  for(i=0; i<len; i++)
+    sum += addr[i];
+  return sum;
+}
+
+// Look for the RSDP in the len bytes at addr.
+static struct acpi_rsdp*
+rsdpsearch1(uint a, int len)
+{
+  uchar *e, *p, *addr;
+
+  addr = P2V(a);
+  e = addr+len;
+  for(p = addr; p < e; p += 16)
+    if(memcmp(p, "RSD PTR ", 8) == 0 && sum(p, 20) == 0)
+      return (struct acpi_rsdp*)p;
+  return 0;
+}
+
+// The RSDP is on a 16-byte boundary in the first KB of the
+// EBDA, or in the BIOS ROM between 0xE0000 and 0xFFFFF.
+static struct acpi_rsdp*
+rsdpsearch(void)
+{
+  uchar *bda;
+  uint p;
+  struct acpi_rsdp *rsdp;
+
+  bda = (uchar *) P2V(0x400);
+  if((p = ((bda[0x0F]<<8)| bda[0x0E]) << 4))
+    if((rsdp = rsdpsearch1(p, 1024)))
+      return rsdp;
+  return rsdpsearch1(0xE0000, 0x20000);
+}
+
+// Map the system description table at physical address pa,
+// and check its signature and checksum. Tables usually lie
+// above PHYSTOP, so they are read through kmapfw(); the
+// returned table is valid until the next call.
+static struct acpi_header*
+acpitable(uint pa, char *sig)
+{
+  struct acpi_header *h;
+
+  h = (struct acpi_header*)kmapfw(pa);
+  if(memcmp(h->signature, sig, 4) != 0)
+    return 0;
+  if(h->length < sizeof(*h) || h->length > PDSIZE)
+    return 0;
+  if(sum((uchar*)h, h->length) != 0)
+    return 0;
+  return h;
+}
+
+static int
+madtparse(struct acpi_madt *madt)
+{
+  uchar *p, *e;
+  struct madt_lapic *lp;
+  struct madt_ioapic *io;
+
+  lapic = (uint*)madt->lapicaddr;
+  e = (uchar*)madt + madt->hdr.length;
+  for(p = (uchar*)(madt+1); p + 2 <= e && p[1] >= 2; p += p[1]){
+    switch(p[0]){
+    case MADT_LAPIC:
+      lp = (struct madt_lapic*)p;
+      if((lp->flags & MADT_ENABLED) && ncpu < NCPU){
+        cpus[ncpu].apicid = lp->apicid;  // apicid may differ from ncpu
+        ncpu++;
+      }
+      break;
+    case MADT_IOAPIC:
+      // Use the I/O APIC that handles the ISA interrupts.
+      io = (struct madt_ioapic*)p;
+      if(io->gsibase == 0){
+        ioapicid = io->apicno;
+        ioapicaddr = io->addr;
+      }
+      break;
+    }
+  }
+  return ncpu > 0 ? 0 : -1;
+}
+
+// Fill in cpus[], ncpu, lapic and the I/O APIC from the MADT.
+// Returns 0, or -1 if there is no usable MADT.
+int
+acpiinit(void)
+{
+  struct acpi_rsdp *rsdp;
+  struct acpi_header *h;
+  uint rsdt[NRSDT];
+  int i, n, r;
+
+  if((rsdp = rsdpsearch()) == 0)
+    return -1;
+  if((h = acpitable(rsdp->rsdtaddr, "RSDT")) == 0){
+    kunmapfw();
+    return -1;
+  }
+  n = (h->length - sizeof(*h)) / sizeof(uint);
+  if(n > NRSDT)
+    n = NRSDT;
+  memmove(rsdt, h+1, n*sizeof(uint));
+
+  r = -1;
+  for(i = 0; i < n; i++){
+    if((h = acpitable(rsdt[i], "APIC")) != 0){
+      r = madtparse((struct acpi_madt*)h);
+      break;
+    }
+  }
+  kunmapfw();
+  return r;
+}
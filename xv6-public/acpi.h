@@ -0,0 +1,51 @@
+// The parts of the ACPI tables the kernel reads.
+// See the ACPI Specification, sections 5.2.5 to 5.2.12.
+
+struct acpi_rsdp {      // root system description pointer
+  uchar signature[8];           // "RSD PTR "
+  uchar checksum;               // first 20 bytes add up to 0
+  uchar oemid[6];
+  uchar revision;               // 0 for ACPI 1.0, 2 for later
+  uint rsdtaddr;                // phys addr of RSDT
+} __attribute__((__packed__));
+
+struct acpi_header {    // header of every system description table
+  uchar signature[4];
+  uint length;                  // whole table, header included
+  uchar revision;
+  uchar checksum;               // all bytes must add up to 0
+  uchar oemid[6];
+  uchar oemtableid[8];
+  uint oemrevision;
+  uchar creatorid[4];
+  uint creatorrevision;
+} __attribute__((__packed__));
+
+struct acpi_madt {      // multiple APIC description table ("APIC")
+  struct acpi_header hdr;
+  uint lapicaddr;               // phys addr of local APIC
+  uint flags;
+  // followed by entries, each starting with type and length
+} __attribute__((__packed__));
+
+struct madt_lapic {     // processor local APIC entry
+  uchar type;                   // MADT_LAPIC
+  uchar length;
+  uchar acpiid;                 // ACPI processor id
+  uchar apicid;                 // local APIC id
+  uint flags;
+    #define MADT_ENABLED 0x01     // The processor is usable.
+} __attribute__((__packed__));
+
+struct madt_ioapic {    // I/O APIC entry
+  uchar type;                   // MADT_IOAPIC
+  uchar length;
+  uchar apicno;                 // I/O APIC id
+  uchar reserved;
+  uint addr;                    // phys addr of I/O APIC
+  uint gsibase;                 // first interrupt it handles
+} __attribute__((__packed__));
+
+// MADT entry types
+#define MADT_LAPIC   0x00  // One per processor
+#define MADT_IOAPIC  0x01  // One per I/O APIC
@@ -21,38 +21,195 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "mutex.h"
 #include "fs.h"
 #include "buf.h"
+#include "kmemstat.h"
+
+// Buffers come in groups of BPERPG sharing one page of
+// data. The cache starts with NBUF buffers and grows a
+// group at a time while free memory lasts; kalloc() and
+// kalloc_pages() call bshrink() to take whole unused groups
+// back when they run out. Headers of freed groups are kept for reuse, since
+// bshrink() can run inside the slab allocator.
+#define BPERPG    (PGSIZE / BSIZE)
+#define NBHASH    1024
+#define BCACHE_RESERVE  (PHYSTOP / PGSIZE / 8)  // free pages not to grow into
+#define BHASH(dev, blockno)  (((dev) * 31 + (blockno)) & (NBHASH-1))
+
+struct bgroup {
+  struct buf buf[BPERPG];
+  char *page;              // Data of the buffers; 0 if spare
+  struct bgroup *next;     // Spare groups
+};
 
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct kmem_cache *cache;  // Group headers
+  struct buf *hash[NBHASH];  // Buffers with a block, by (dev, blockno)
+  struct bgroup *spare;      // Group headers without a page
+  uint ngroup;               // Groups with a page
+  struct bcachestat stat;
 
   // Linked list of all buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
 } bcache;
 
+// Return the pages holding buffer data.
+uint
+bcachepages(void)
+{
+  return bcache.ngroup;
+}
+
+// Copy the cache counters to st.
 void
-binit(void)
+bcachestat(struct bcachestat *st)
+{
+  acquire(&bcache.lock);
+  *st = bcache.stat;
+  st->pages = bcache.ngroup;
+  release(&bcache.lock);
+}
+
+static void
+bhash(struct buf *b)
+{
+  struct buf **bp = &bcache.hash[BHASH(b->dev, b->blockno)];
+
+  b->hnext = *bp;
+  *bp = b;
+}
+
+// Remove b from the hash table, if it is there.
+static void
+bunhash(struct buf *b)
+{
+  struct buf **bp;
+
+  for(bp = &bcache.hash[BHASH(b->dev, b->blockno)]; *bp; bp = &(*bp)->hnext){
+    if(*bp == b){
+      *bp = b->hnext;
+      break;
+    }
+  }
+  b->hnext = 0;
+}
+
+// Add a group of empty buffers to the cache.
+// Returns -1 if out of memory.
+// Must not be called holding bcache.lock: kalloc() may
+// call bshrink().
+static int
+bgrow(void)
 {
+  struct bgroup *g;
   struct buf *b;
+  char *page;
 
-  initlock(&bcache.lock, "bcache");
+  if((page = kalloc()) == 0)
+    return -1;
+
+  acquire(&bcache.lock);
+  if((g = bcache.spare) != 0)
+    bcache.spare = g->next;
+  release(&bcache.lock);
+
+  if(g == 0){
+    if((g = kmem_cache_alloc(bcache.cache)) == 0){
+      kfree(page);
+      return -1;
+    }
+    memset(g, 0, sizeof(*g));
+    for(b = g->buf; b < &g->buf[BPERPG]; b++)
+      initmutex(&b->lock, "buffer");
+  }
+  g->page = page;
+
+  // New buffers go to the LRU end, to be used first.
+  acquire(&bcache.lock);
+  for(b = g->buf; b < &g->buf[BPERPG]; b++){
+    b->flags = 0;
+    b->refcnt = 0;
+    b->hnext = 0;
+    b->group = g;
+    b->data = (uchar*)page + (b - g->buf) * BSIZE;
+    b->prev = bcache.head.prev;
+    b->next = &bcache.head;
+    bcache.head.prev->next = b;
+    bcache.head.prev = b;
+  }
+  bcache.ngroup++;
+  bcache.stat.grow++;
+  release(&bcache.lock);
+  return 0;
+}
+
+// Free up to n pages of unused buffers, keeping at least
+// NBUF buffers. Returns the number of pages freed.
+int
+bshrink(int n)
+{
+  struct buf *b, *prev, *gb;
+  struct bgroup *g;
+  char *page;
+  int freed;
+
+  freed = 0;
+  acquire(&bcache.lock);
+  for(b = bcache.head.prev; b != &bcache.head && freed < n; b = prev){
+    prev = b->prev;
+    if((bcache.ngroup - 1) * BPERPG < NBUF)
+      break;
+    g = b->group;
+    for(gb = g->buf; gb < &g->buf[BPERPG]; gb++)
+      if(gb->refcnt != 0 || (gb->flags & B_DIRTY))
+        break;
+    if(gb < &g->buf[BPERPG])
+      continue;
+
+    // The whole group is unused; unlink it.
+    for(gb = g->buf; gb < &g->buf[BPERPG]; gb++){
+      bunhash(gb);
+      if(gb == prev)
+        prev = gb->prev;
+      gb->next->prev = gb->prev;
+      gb->prev->next = gb->next;
+      gb->flags = 0;
+    }
+    page = g->page;
+    g->page = 0;
+    g->next = bcache.spare;
+    bcache.spare = g;
+    bcache.ngroup--;
+    bcache.stat.shrink++;
+    kfree(page);
+    freed++;
+  }
+  release(&bcache.lock);
+  return freed;
+}
+
+void
+binit(void)
+{
+  int i;
+
+  initmcslock(&bcache.lock, "bcache");
+  bcache.cache = kmem_cache_create("bufgroup", sizeof(struct bgroup));
 
 //PAGEBREAK!
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
+  for(i = 0; i < NBUF; i += BPERPG)
+    if(bgrow() < 0)
+      panic("binit");
 }
 
 // Look through buffer cache for block on device dev.
@@ -62,30 +219,50 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  int grown;
 
+  grown = 0;
   acquire(&bcache.lock);
 
+again:
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bcache.hash[BHASH(dev, blockno)]; b; b = b->hnext){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
+      if(!grown)
+        bcache.stat.hit++;
       release(&bcache.lock);
-      acquiresleep(&b->lock);
+      acquiremutex(&b->lock);
       return b;
     }
   }
 
-  // Not cached; recycle an unused buffer.
+  // Not cached. Grow the cache while memory is plentiful,
+  // so as to keep the blocks already cached.
+  if(!grown){
+    bcache.stat.miss++;
+    grown = 1;
+    if(kfreepages() > BCACHE_RESERVE){
+      release(&bcache.lock);
+      bgrow();
+      acquire(&bcache.lock);
+      goto again;
+    }
+  }
+
+  // Recycle an unused buffer.
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
   // because log.c has modified it but not yet committed it.
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
     if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
+      bunhash(b);
       b->dev = dev;
       b->blockno = blockno;
+      bhash(b);
       b->flags = 0;
       b->refcnt = 1;
       release(&bcache.lock);
-      acquiresleep(&b->lock);
+      acquiremutex(&b->lock);
       return b;
     }
   }
@@ -109,7 +286,7 @@ bread(uint dev, uint blockno)
 void
 bwrite(struct buf *b)
 {
-  if(!holdingsleep(&b->lock))
+  if(!holdingmutex(&b->lock))
     panic("bwrite");
   b->flags |= B_DIRTY;
   iderw(b);
@@ -120,10 +297,10 @@ bwrite(struct buf *b)
 void
 brelse(struct buf *b)
 {
-  if(!holdingsleep(&b->lock))
+  if(!holdingmutex(&b->lock))
     panic("brelse");
 
-  releasesleep(&b->lock);
+  releasemutex(&b->lock);
 
   acquire(&bcache.lock);
   b->refcnt--;
@@ -2,12 +2,14 @@ struct buf {
   int flags;
   uint dev;
   uint blockno;
-  struct sleeplock lock;
+  struct mutex lock;
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *hnext; // bcache hash chain
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  struct bgroup *group; // buffers sharing the page of data
+  uchar *data;       // BSIZE bytes
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
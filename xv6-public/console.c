@@ -8,6 +8,7 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "mutex.h"
 #include "fs.h"
 #include "file.h"
 #include "memlayout.h"
@@ -2,11 +2,24 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct irqstat;
+struct lockstat;
+struct kcachestat;
+struct buddystat;
+struct kmem_cache;
+struct slabstat;
+struct superstat;
+struct bcachestat;
+struct meminfo;
+struct procmem;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct shm;
 struct spinlock;
 struct sleeplock;
+struct mutex;
+struct slwaiter;
 struct stat;
 struct superblock;
 
@@ -15,6 +28,9 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+uint            bcachepages(void);
+void            bcachestat(struct bcachestat*);
+int             bshrink(int);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +40,7 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+int             spawn(char*, char**, struct file**);
 
 // file.c
 struct file*    filealloc(void);
@@ -50,6 +67,7 @@ void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+int             ishrink(int);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
@@ -57,6 +75,9 @@ int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
+// acpi.c
+int             acpiinit(void);
+
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
@@ -64,12 +85,26 @@ void            iderw(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
+int             ioapicroute(int irq, int cpu);
+int             ioapiccpu(int irq);
 extern uchar    ioapicid;
+extern uint     ioapicaddr;
 void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+char*           kalloc_pages(int);
+char*           kzalloc(void);
+void            kshare(char*);
+void            ksplit(char*, int);
+int             kshared(char*);
+void            kzero_idle(void);
+void            kfree_pages(char*, int);
+int             kcachestat(struct kcachestat*, int);
+void            kbuddystat(struct buddystat*);
+void            kmeminfo(struct meminfo*);
+uint            kfreepages(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -81,6 +116,7 @@ void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
+void            lapicipi(uchar, int);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
@@ -100,6 +136,7 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -112,10 +149,19 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            lockvm(struct proc*);
+void            unlockvm(struct proc*);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
+struct thread*  mythread(void);
 void            pinit(void);
 void            procdump(void);
+struct proc*    allocproc(void);
+void            freeproc(struct proc*);
+int             startproc(struct proc*);
+int             procsuperstat(struct superstat*, int);
+int             procmeminfo(struct meminfo*, struct procmem*, int);
+int             procevict(char**, uint*, int);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
@@ -128,6 +174,18 @@ int             set_cpu_share(struct proc*, int);
 int             thread_create(thread_t *thread, void *(*start_routine)(void*), void* arg);
 void            thread_exit(void *retval);
 int             thread_join(thread_t thread, void **retval);
+void            thread_collapse(struct proc*);
+void            pi_wait(struct sleeplock*, struct slwaiter*);
+void            pi_acquired(struct sleeplock*, struct slwaiter*);
+void            pi_release(struct sleeplock*);
+
+// swap.c
+void            swapinit(int);
+void            swapdup(uint);
+void            swapput(uint);
+void            swapread(uint, char*);
+void            swapreclaim(void);
+void            swapinfo(struct meminfo*);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -137,15 +195,46 @@ void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initmcslock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
+struct lockstat* lockstat_register(char*, int);
+void            lockstat_acquired(struct lockstat*, int, uint64, uint*);
+void            lockstat_released(struct lockstat*, uint64);
+int             lockstat_dump(struct lockstat*, int);
+int             lockstat_reset(void);
+
+// shm.c
+void            shminit(void);
+struct shm*     shmopen(char*, uint);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+uint            shmsize(struct shm*);
+char*           shmpage(struct shm*, uint);
+int             shmid(struct shm*);
+struct shm*     shmget(int);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+int             kslabstat(struct slabstat*, int);
+uint            kslabpages(char*);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+int             tryacquiresleep(struct sleeplock*);
+
+// mutex.c
+void            acquiremutex(struct mutex*);
+void            releasemutex(struct mutex*);
+int             holdingmutex(struct mutex*);
+void            initmutex(struct mutex*, char*);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -167,11 +256,18 @@ void            syscall(void);
 // timer.c
 void            timerinit(void);
 
+// tlb.c
+void            tlbjoin(struct proc*);
+void            tlbleave(struct proc*);
+void            tlbpoll(void);
+void            tlbshoot(struct proc*, uint, uint);
+
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
+int             irqstat(struct irqstat*, int);
 
 // uart.c
 void            uartinit(void);
@@ -181,14 +277,32 @@ void            uartputc(int);
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
+char*           kmapfw(uint);
+void            kunmapfw(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
+int             shrinkuvm(struct proc*, uint, uint);
+int             splitsuper(pde_t*, uint, uint);
+void            uvmstat(struct proc*, struct procmem*);
+int             uvmevict(struct proc*, char**, uint*, int);
+uint            kvmpages(void);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+struct vma*     findvma(struct proc*, uint);
+void            dupvmas(struct vma*, struct vma*);
+void            freevmas(struct vma*);
+void            trimvmas(struct proc*, uint);
+int             prefault(uint, uint);
+pde_t*          copyuvm(struct proc*);
+int             pagefault(uint, uint);
+int             killfault(uint);
+int             mmap(uint, uint, int, int, struct inode*, uint, uint);
+int             munmap(uint, uint);
+void            msync(uint, uint);
+int             shmattach(struct shm*, uint);
+int             shmdetach(uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
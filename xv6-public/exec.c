@@ -7,8 +7,22 @@
 #include "x86.h"
 #include "elf.h"
 
-int
-exec(char *path, char **argv)
+// A user image built by loadimage(), not yet given to
+// any process.
+struct image {
+  pde_t *pgdir;
+  uint sz;
+  uint sp;
+  uint entry;
+  struct vma vmas[NVMA];
+  char name[16];
+};
+
+// Build the image of the program at path, called with
+// arguments argv. Doesn't touch the current process.
+// Returns 0, or -1 with nothing left allocated.
+static int
+loadimage(char *path, char **argv, struct image *im)
 {
   char *s, *last;
   int i, off;
@@ -16,10 +30,14 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
-  struct thread *t;
-
+  struct vma *vmas;
+  int nvma;
+  pde_t *pgdir;
+
+  vmas = im->vmas;
+  memset(vmas, 0, sizeof(im->vmas));
+  nvma = 0;
+  swapreclaim();
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -39,7 +57,8 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map the program's segments. Nothing is read now;
+  // pagefault() pages them in from ip on first touch.
   sz = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
@@ -50,12 +69,20 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz >= MMAPBASE)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.vaddr < sz || nvma == NVMA)
       goto bad;
+    vmas[nvma].start = ph.vaddr;
+    vmas[nvma].end = PGROUNDUP(ph.vaddr + ph.memsz);
+    vmas[nvma].flags = VMA_USED | VMA_WRITE;
+    vmas[nvma].ip = idup(ip);
+    vmas[nvma].off = ph.off;
+    vmas[nvma].filesz = ph.filesz;
+    nvma++;
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
@@ -64,6 +91,8 @@ exec(char *path, char **argv)
   // Allocate two pages at the next page boundary.
   // Make the first inaccessible.  Use the second as the user stack.
   sz = PGROUNDUP(sz);
+  if(sz + 2*PGSIZE > MMAPBASE)
+    goto bad;
   if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
     goto bad;
   clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
@@ -92,45 +121,105 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(im->name, last, sizeof(im->name));
 
-  // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  if (curproc->curtid != 0)
-  {
-    curproc->ustack_pool[0] = sz;
-    MAIN(curproc) = curproc->threads[curproc->curtid];
-    curproc->threads[curproc->curtid].kstack = 0;
+  im->pgdir = pgdir;
+  im->sz = sz;
+  im->sp = sp;
+  im->entry = elf.entry;
+  return 0;
+
+ bad:
+  if(pgdir)
+    freevm(pgdir);
+  if(ip){
+    iunlockput(ip);
+    freevmas(vmas);
+    end_op();
+  } else if(nvma > 0){
+    begin_op();
+    freevmas(vmas);
+    end_op();
   }
-  MAIN(curproc).tf->eip = elf.entry;  // main
-  MAIN(curproc).tf->esp = sp;
-  curproc->curtid = 0;
+  return -1;
+}
+
+int
+exec(char *path, char **argv)
+{
+  struct image im;
+  struct vma oldvmas[NVMA];
+  pde_t *oldpgdir;
+  struct proc *curproc = myproc();
 
-  for (t = &curproc->threads[1]; t < &curproc->threads[NTHREAD]; ++t)
-  {
-    if (t->kstack)
-      kfree(t->kstack);
+  if(loadimage(path, argv, &im) < 0)
+    return -1;
 
-    t->kstack = 0;
-    t->state = UNUSED;
-    t->tid = 0;
-    t->retval = 0;
+  // Write back the old image's shared mappings.
+  msync(MMAPBASE, KERNBASE);
 
-    curproc->ustack_pool[t - curproc->threads] = 0;
-  }
+  // Commit to the user image.
+  safestrcpy(curproc->name, im.name, sizeof(curproc->name));
+  oldpgdir = curproc->pgdir;
+  curproc->pgdir = im.pgdir;
+  curproc->sz = im.sz;
+  memmove(oldvmas, curproc->vmas, sizeof(oldvmas));
+  memmove(curproc->vmas, im.vmas, sizeof(im.vmas));
+  curproc->ustack_pool[0] = im.sz;
+  thread_collapse(curproc);
+  MAIN(curproc).tf->eip = im.entry;  // main
+  MAIN(curproc).tf->esp = im.sp;
 
   switchuvm(curproc);
   freevm(oldpgdir);
+  begin_op();
+  freevmas(oldvmas);
+  end_op();
   return 0;
+}
 
- bad:
-  if(pgdir)
-    freevm(pgdir);
-  if(ip){
-    iunlockput(ip);
-    end_op();
+// Create a child of the current process running the
+// program at path, without copying the caller's memory.
+// The child gets the open files ofile, whose references
+// spawn() takes over whether it succeeds or not.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct file **ofile)
+{
+  struct image im;
+  struct proc *np;
+  int fd;
+
+  if((np = allocproc()) == 0)
+    goto bad;
+  if(loadimage(path, argv, &im) < 0){
+    freeproc(np);
+    goto bad;
   }
+
+  np->pgdir = im.pgdir;
+  np->sz = im.sz;
+  memmove(np->vmas, im.vmas, sizeof(im.vmas));
+  memset(MAIN(np).tf, 0, sizeof(*MAIN(np).tf));
+  MAIN(np).tf->cs = (SEG_UCODE << 3) | DPL_USER;
+  MAIN(np).tf->ds = (SEG_UDATA << 3) | DPL_USER;
+  MAIN(np).tf->es = MAIN(np).tf->ds;
+  MAIN(np).tf->ss = MAIN(np).tf->ds;
+  MAIN(np).tf->eflags = FL_IF;
+  MAIN(np).tf->eip = im.entry;
+  MAIN(np).tf->esp = im.sp;
+  memset(np->ustack_pool, 0, sizeof(np->ustack_pool));
+  np->ustack_pool[0] = im.sz;
+
+  memmove(np->ofile, ofile, sizeof(np->ofile));
+  np->cwd = idup(myproc()->cwd);
+  safestrcpy(np->name, im.name, sizeof(np->name));
+
+  return startproc(np);
+
+bad:
+  for(fd = 0; fd < NOFILE; fd++)
+    if(ofile[fd])
+      fileclose(ofile[fd]);
   return -1;
 }
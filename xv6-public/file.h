@@ -14,7 +14,10 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
-  struct sleeplock lock; // protects everything below here
+  struct inode *next; // Next inode in icache
+  struct inode *lprev; // LRU list, when ref == 0
+  struct inode *lnext;
+  struct mutex lock;  // protects everything below here
   int valid;          // inode has been read from disk?
 
   short type;         // copy of disk inode
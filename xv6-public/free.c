@@ -0,0 +1,46 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "meminfo.h"
+
+// Show memory use, in KB.
+//   free      system totals and memory by purpose
+//   free -p   the same, and the memory of each process
+
+#define KB(pages) ((pages) * 4)
+
+struct meminfo mi;
+struct procmem pm[NPROC];
+
+int
+main(int argc, char *argv[])
+{
+  int n, i;
+
+  if ((n = meminfo(&mi, pm, NPROC)) < 0)
+  {
+    printf(2, "free: meminfo failed\n");
+    exit();
+  }
+
+  printf(1, "total %d used %d free %d (cached %d)\n", KB(mi.total),
+         KB(mi.total - mi.free), KB(mi.free), KB(mi.cached));
+  printf(1, "kernel %d pgtab %d kstack %d slab %d (pipe %d) buf %d user %d\n",
+         KB(mi.kernel), KB(mi.pgtab), KB(mi.kstack), KB(mi.slab),
+         KB(mi.pipe), KB(mi.buf), KB(mi.user));
+  printf(1, "swap %d used %d free %d\n", KB(mi.swap),
+         KB(mi.swap - mi.swapfree), KB(mi.swapfree));
+
+  if (argc < 2 || strcmp(argv[1], "-p") != 0)
+    exit();
+
+  printf(1, "\npid name: text heap stack mmap pgtab kstack swap"
+            " (pages in out)\n");
+  for (i = 0; i < n; ++i)
+    printf(1, "%d %s: %d %d %d %d %d %d %d (%d %d)\n", pm[i].pid,
+           pm[i].name, KB(pm[i].text), KB(pm[i].heap), KB(pm[i].stack),
+           KB(pm[i].mmap), KB(pm[i].pgtab), KB(pm[i].kstack),
+           KB(pm[i].swap), pm[i].swapin, pm[i].swapout);
+  exit();
+}
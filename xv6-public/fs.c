@@ -17,6 +17,7 @@
 #include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "mutex.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
@@ -105,7 +106,7 @@ bfree(int dev, uint b)
 // sb.startinode. Each inode has a number, indicating its
 // position on the disk.
 //
-// The kernel keeps a cache of in-use inodes in memory
+// The kernel keeps a cache of recently used inodes in memory
 // to provide a place for synchronizing access
 // to inodes used by multiple processes. The cached
 // inodes include book-keeping information that is
@@ -119,18 +120,21 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
+// * Referencing in cache: entries live on the icache.active
+//   list, allocated from the "inode" slab cache. ip->ref tracks
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. An entry whose ref reaches zero stays
+//   cached on the icache.lru list, up to NILRU of them, and
+//   the least recently used is freed or reused beyond that
+//   or when memory runs short (ishrink()).
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -163,26 +167,32 @@ bfree(int dev, uint b)
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NILRU  50  // unreferenced inodes kept cached
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode *active;   // all cached inodes
+  int nlru;
+
+  // Linked list of inodes with ref == 0, through lprev/lnext.
+  // lru.lnext is most recently used.
+  struct inode lru;
 } icache;
 
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode));
+  icache.lru.lprev = &icache.lru;
+  icache.lru.lnext = &icache.lru;
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
-          sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+ inodestart %d bmap start %d swap start %d nswap %d\n", sb.size,
+          sb.nblocks, sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
+          sb.bmapstart, sb.swapstart, sb.nswap);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -190,23 +200,29 @@ static struct inode* iget(uint dev, uint inum);
 //PAGEBREAK!
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode.
+// Returns an unlocked but allocated and referenced inode,
+// or 0 if there is no memory to cache it.
 struct inode*
 ialloc(uint dev, short type)
 {
   int inum;
   struct buf *bp;
   struct dinode *dip;
+  struct inode *ip;
 
   for(inum = 1; inum < sb.ninodes; inum++){
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
+      if((ip = iget(dev, inum)) == 0){
+        brelse(bp);
+        return 0;
+      }
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
-      return iget(dev, inum);
+      return ip;
     }
     brelse(bp);
   }
@@ -235,42 +251,90 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+// Take ip, which has ref == 0, off the LRU list.
+// Caller must hold icache.lock.
+static void
+lruremove(struct inode *ip)
+{
+  ip->lnext->lprev = ip->lprev;
+  ip->lprev->lnext = ip->lnext;
+  icache.nlru--;
+}
+
+// Take ip, which has ref == 0, off the LRU list and out of
+// the cache, leaving its memory to the caller.
+// Caller must hold icache.lock.
+static void
+ievict(struct inode *ip)
+{
+  struct inode **pp;
+
+  lruremove(ip);
+  for(pp = &icache.active; *pp != ip; pp = &(*pp)->next)
+    ;
+  *pp = ip->next;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Returns 0 if there is no memory for a new entry.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.active; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Allocate a new inode cache entry, or reuse the
+  // least recently used one.
+  if((ip = kmem_cache_alloc(icache.cache)) == 0){
+    if((ip = icache.lru.lprev) == &icache.lru){
+      release(&icache.lock);
+      return 0;
+    }
+    ievict(ip);
+  }
 
-  ip = empty;
+  initmutex(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->next = icache.active;
+  icache.active = ip;
   release(&icache.lock);
 
   return ip;
 }
 
+// Free up to n unreferenced inodes, least recently used
+// first. Returns the number freed.
+int
+ishrink(int n)
+{
+  struct inode *ip;
+  int freed;
+
+  acquire(&icache.lock);
+  for(freed = 0; freed < n && (ip = icache.lru.lprev) != &icache.lru; freed++){
+    ievict(ip);
+    kmem_cache_free(icache.cache, ip);
+  }
+  release(&icache.lock);
+  return freed;
+}
+
 // Increment reference count for ip.
 // Returns ip to enable ip = idup(ip1) idiom.
 struct inode*
@@ -293,7 +357,7 @@ ilock(struct inode *ip)
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquiresleep(&ip->lock);
+  acquiremutex(&ip->lock);
 
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
@@ -315,15 +379,15 @@ ilock(struct inode *ip)
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || !holdingmutex(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
-  releasesleep(&ip->lock);
+  releasemutex(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry
+// goes on the LRU list to be reused or freed later.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -331,7 +395,9 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquiresleep(&ip->lock);
+  struct inode *old;
+
+  acquiremutex(&ip->lock);
   if(ip->valid && ip->nlink == 0){
     acquire(&icache.lock);
     int r = ip->ref;
@@ -344,11 +410,28 @@ iput(struct inode *ip)
       ip->valid = 0;
     }
   }
-  releasesleep(&ip->lock);
+  releasemutex(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref > 0){
+    release(&icache.lock);
+    return;
+  }
+  ip->lnext = icache.lru.lnext;
+  ip->lprev = &icache.lru;
+  icache.lru.lnext->lprev = ip;
+  icache.lru.lnext = ip;
+  icache.nlru++;
+  old = 0;
+  if(!ip->valid)
+    old = ip;  // freed on disk; not worth keeping
+  else if(icache.nlru > NILRU)
+    old = icache.lru.lprev;
+  if(old)
+    ievict(old);
   release(&icache.lock);
+  if(old)
+    kmem_cache_free(icache.cache, old);
 }
 
 // Common idiom: unlock, then put.
@@ -676,12 +759,14 @@ dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
   struct dirent de;
-  struct inode *ip;
 
-  // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
-    iput(ip);
-    return -1;
+  // Check that name is not present. Compare names rather
+  // than call dirlookup(), which fails without memory.
+  for(off = 0; off < dp->size; off += sizeof(de)){
+    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirlink read");
+    if(de.inum != 0 && namecmp(name, de.name) == 0)
+      return -1;
   }
 
   // Look for an empty dirent.
@@ -749,9 +834,10 @@ namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
 
-  if(*path == '/')
-    ip = iget(ROOTDEV, ROOTINO);
-  else
+  if(*path == '/'){
+    if((ip = iget(ROOTDEV, ROOTINO)) == 0)
+      return 0;
+  } else
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
@@ -10,6 +10,7 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "mutex.h"
 #include "fs.h"
 #include "buf.h"
 
@@ -75,7 +76,7 @@ idestart(struct buf *b)
 {
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  if(b->blockno >= FSSIZE + SWAPSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
@@ -139,7 +140,7 @@ iderw(struct buf *b)
 {
   struct buf **pp;
 
-  if(!holdingsleep(&b->lock))
+  if(!holdingmutex(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
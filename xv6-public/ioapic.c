@@ -4,6 +4,10 @@
 
 #include "types.h"
 #include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
 #include "traps.h"
 
 #define IOAPIC  0xFEC00000   // Default physical address of IO APIC
@@ -24,6 +28,11 @@
 
 volatile struct ioapic *ioapic;
 
+// ioapiclock keeps the reg/data pairs of CPUs apart,
+// now that IRQs can be rerouted at any time.
+static struct spinlock ioapiclock;
+static int route[NIRQ];   // CPU each IRQ goes to, or -1
+
 // IO APIC MMIO structure: write reg, then read or write data.
 struct ioapic {
   uint reg;
@@ -50,7 +59,10 @@ ioapicinit(void)
 {
   int i, id, maxintr;
 
-  ioapic = (volatile struct ioapic*)IOAPIC;
+  initlock(&ioapiclock, "ioapic");
+  for(i = 0; i < NIRQ; i++)
+    route[i] = -1;
+  ioapic = (volatile struct ioapic*)(ioapicaddr ? ioapicaddr : IOAPIC);
   maxintr = (ioapicread(REG_VER) >> 16) & 0xFF;
   id = ioapicread(REG_ID) >> 24;
   if(id != ioapicid)
@@ -68,8 +80,37 @@ void
 ioapicenable(int irq, int cpunum)
 {
   // Mark interrupt edge-triggered, active high,
-  // enabled, and routed to the given cpunum,
-  // which happens to be that cpu's APIC ID.
+  // enabled, and routed to cpus[cpunum] by its APIC ID,
+  // which needn't be cpunum.
+  acquire(&ioapiclock);
   ioapicwrite(REG_TABLE+2*irq, T_IRQ0 + irq);
-  ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+  ioapicwrite(REG_TABLE+2*irq+1, cpus[cpunum].apicid << 24);
+  if(irq < NIRQ)
+    route[irq] = cpunum;
+  release(&ioapiclock);
+}
+
+// Send irq, which must be enabled, to cpus[cpunum] from
+// now on. Returns 0, or -1 if irq or cpunum is not valid.
+int
+ioapicroute(int irq, int cpunum)
+{
+  if(irq < 0 || irq >= NIRQ || cpunum < 0 || cpunum >= ncpu)
+    return -1;
+  acquire(&ioapiclock);
+  if(route[irq] < 0){
+    release(&ioapiclock);
+    return -1;
+  }
+  ioapicwrite(REG_TABLE+2*irq+1, cpus[cpunum].apicid << 24);
+  route[irq] = cpunum;
+  release(&ioapiclock);
+  return 0;
+}
+
+// Return the CPU irq is routed to, or -1 if it is disabled.
+int
+ioapiccpu(int irq)
+{
+  return route[irq];
 }
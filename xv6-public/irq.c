@@ -0,0 +1,63 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "irq.h"
+
+// Show or change where device interrupts go.
+//   irq             for each IRQ taken so far or routed, the
+//                   CPU it is routed to and the count per CPU
+//   irq IRQ CPU     route IRQ to CPU from now on
+//
+// IRQ 0 is each CPU's local timer, which isn't routed.
+
+struct irqstat st[NIRQ];
+
+int
+main(int argc, char *argv[])
+{
+  int n, i, c;
+  uint total;
+
+  if (argc == 3)
+  {
+    if (irqaffinity(atoi(argv[1]), atoi(argv[2])) < 0)
+    {
+      printf(2, "irq: can't route irq %s to cpu %s\n", argv[1], argv[2]);
+      exit();
+    }
+    exit();
+  }
+  if (argc != 1)
+  {
+    printf(2, "usage: irq [irq cpu]\n");
+    exit();
+  }
+
+  if ((n = irqstat(st, NIRQ)) < 0)
+  {
+    printf(2, "irq: failed\n");
+    exit();
+  }
+
+  printf(1, "irq: cpu total");
+  for (c = 0; c < n; ++c)
+    printf(1, " cpu%d", c);
+  printf(1, "\n");
+  for (i = 0; i < NIRQ; ++i)
+  {
+    total = 0;
+    for (c = 0; c < n; ++c)
+      total += st[i].count[c];
+    if (total == 0 && st[i].cpu < 0)
+      continue;
+    if (st[i].cpu < 0)
+      printf(1, "%d: - %d", i, total);
+    else
+      printf(1, "%d: %d %d", i, st[i].cpu, total);
+    for (c = 0; c < n; ++c)
+      printf(1, " %d", st[i].count[c]);
+    printf(1, "\n");
+  }
+  exit();
+}
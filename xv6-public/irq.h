@@ -0,0 +1,7 @@
+// Interrupt routing and counters, see the irqstat and
+// irqaffinity system calls.
+
+struct irqstat {
+  int cpu;           // CPU the I/O APIC sends the IRQ to, -1 if none
+  uint count[NCPU];  // Interrupts taken by each CPU
+};
@@ -1,28 +1,86 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and physically
+// contiguous blocks of 2^order pages with kalloc_pages().
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "x86.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "kmemstat.h"
+#include "meminfo.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+#define NORDER  KMEM_NORDER
+#define NPAGE   (PHYSTOP / PGSIZE)
+
+// A free block, stored in its own first page.
 struct run {
   struct run *next;
+  struct run *prev;
+};
+
+// Per physical page state.
+struct page {
+  uchar order;       // Order of the block starting at this page
+  uchar free;        // Does a free block start at this page?
+  uint share;        // References beyond the first (copy-on-write)
 };
 
+// Free memory is kept by a binary buddy allocator. A block
+// of order k is 2^k pages, aligned to its size in physical
+// memory; its buddy is the other half of the order k+1
+// block containing it. Freeing a block merges it with its
+// buddy for as long as the buddy is free too.
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *freelist[NORDER];
+  uint nfree;        // Free pages in freelist
+  struct buddystat stat;
 } kmem;
 
+struct page pages[NPAGE];
+
+#define PAGE(v)      (&pages[V2P(v) / PGSIZE])
+#define BLKSIZE(o)   (PGSIZE << (o))
+
+// Each CPU keeps a magazine of free pages so that most
+// kalloc/kfree calls don't touch kmem.lock. An empty
+// magazine takes KCACHE_BATCH pages from kmem.freelist;
+// one holding more than KCACHE_HIGH pages gives the
+// excess back, keeping KCACHE_LOW.
+// At most NCPU*KCACHE_HIGH pages sit in magazines, where
+// other CPUs can't reach them.
+#define KCACHE_HIGH   64
+#define KCACHE_LOW    16
+#define KCACHE_BATCH  32
+
+// Each CPU also keeps up to KZERO_TARGET pages zeroed ahead
+// of time, filled from the scheduler's idle loop and handed
+// out by kzalloc(). It stops below KZERO_FLOOR free pages,
+// twice swap.c's SWAPLOW, where reclaim aims to keep memory.
+// The pool counts as free memory: kalloc() falls back on
+// the pools of all CPUs before failing, so zlock guards it.
+#define KZERO_TARGET  256
+#define KZERO_FLOOR   512
+
+struct kcache {
+  struct run *freelist;
+  int nfree;
+  struct spinlock zlock;
+  struct run *zerolist;
+  int nzero;
+  struct kcachestat stat;
+} kcache[NCPU];
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,7 +89,11 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
-  initlock(&kmem.lock, "kmem");
+  int i;
+
+  initmcslock(&kmem.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kcache[i].zlock, "kzero");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -51,6 +113,130 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+
+//PAGEBREAK: 24
+// Buddy allocator internals. Caller must hold kmem.lock
+// (or be alone during boot).
+
+static void
+buddy_push(char *v, int order)
+{
+  struct run *r = (struct run*)v;
+  struct page *pg = PAGE(v);
+
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  pg->order = order;
+  pg->free = 1;
+  kmem.stat.nfree[order]++;
+}
+
+static void
+buddy_unlink(char *v, int order)
+{
+  struct run *r = (struct run*)v;
+
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  PAGE(v)->free = 0;
+  kmem.stat.nfree[order]--;
+}
+
+static char*
+buddy_alloc(int order)
+{
+  char *v;
+  int k;
+
+  for(k = order; k < NORDER; k++)
+    if(kmem.freelist[k])
+      break;
+  if(k == NORDER){
+    kmem.stat.fail[order]++;
+    return 0;
+  }
+
+  v = (char*)kmem.freelist[k];
+  buddy_unlink(v, k);
+
+  // Split, giving back the upper halves.
+  while(k > order){
+    k--;
+    buddy_push(v + BLKSIZE(k), k);
+  }
+  PAGE(v)->order = order;
+  kmem.nfree -= 1 << order;
+  return v;
+}
+
+static void
+buddy_free(char *v, int order)
+{
+  uint pa, bpa;
+  struct page *bp;
+
+  kmem.nfree += 1 << order;
+
+  pa = V2P(v);
+  for(; order < NORDER - 1; order++){
+    bpa = pa ^ BLKSIZE(order);
+    if(bpa + BLKSIZE(order) > PHYSTOP)
+      break;
+    bp = &pages[bpa / PGSIZE];
+    if(!bp->free || bp->order != order)
+      break;
+    buddy_unlink(P2V(bpa), order);
+    pa &= ~BLKSIZE(order);
+  }
+  buddy_push(P2V(pa), order);
+}
+
+// Move up to KCACHE_BATCH pages from kmem to kc.
+// Caller must have interrupts disabled.
+static void
+krefill(struct kcache *kc)
+{
+  struct run *r;
+  int n;
+
+  acquire(&kmem.lock);
+  for(n = 0; n < KCACHE_BATCH && (r = (struct run*)buddy_alloc(0)) != 0; n++){
+    r->next = kc->freelist;
+    kc->freelist = r;
+  }
+  release(&kmem.lock);
+
+  kc->nfree += n;
+  if(n > 0)
+    kc->stat.refill++;
+}
+
+// Move n pages from kc back to kmem.
+// Caller must have interrupts disabled.
+static void
+kdrain(struct kcache *kc, int n)
+{
+  struct run *r;
+
+  kc->nfree -= n;
+  kc->stat.drain++;
+
+  acquire(&kmem.lock);
+  while(n-- > 0){
+    r = kc->freelist;
+    kc->freelist = r->next;
+    buddy_free((char*)r, 0);
+  }
+  release(&kmem.lock);
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -59,21 +245,55 @@ freerange(void *vstart, void *vend)
 void
 kfree(char *v)
 {
+  struct kcache *kc;
   struct run *r;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
+  if(PAGE(v)->free || PAGE(v)->order != 0)
+    panic("kfree: not an allocated page");
+
+  // Only drop our reference if the page is shared.
+  if(PAGE(v)->share){
+    if(xadd(&PAGE(v)->share, -1) != 0)
+      return;
+    PAGE(v)->share = 0;
+  }
 
+#ifdef KJUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
+
+  if(!kmem.use_lock){
+    // Still booting on one CPU; no magazines yet.
+    buddy_free(v, 0);
+    return;
+  }
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  pushcli();
+  kc = &kcache[cpuid()];
+  r->next = kc->freelist;
+  kc->freelist = r;
+  if(++kc->nfree > KCACHE_HIGH)
+    kdrain(kc, kc->nfree - KCACHE_LOW);
+  popcli();
+}
+
+// Take a page from kc's zeroed pool, or return 0.
+static struct run*
+ztake(struct kcache *kc)
+{
+  struct run *r;
+
+  acquire(&kc->zlock);
+  if((r = kc->zerolist) != 0){
+    kc->zerolist = r->next;
+    kc->nzero--;
+  }
+  release(&kc->zlock);
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -82,15 +302,245 @@ kfree(char *v)
 char*
 kalloc(void)
 {
+  struct kcache *kc;
+  struct run *r;
+  int i, me;
+
+  if(!kmem.use_lock)
+    return buddy_alloc(0);
+
+  pushcli();
+  me = cpuid();
+  kc = &kcache[me];
+  if(kc->freelist){
+    kc->stat.hit++;
+  } else {
+    kc->stat.miss++;
+    krefill(kc);
+  }
+  r = kc->freelist;
+  if(r == 0 && bshrink(KCACHE_BATCH) > 0){
+    // Out of memory; take pages back from the buffer cache.
+    r = kc->freelist;
+  }
+  if(r){
+    kc->freelist = r->next;
+    kc->nfree--;
+  } else {
+    // Out of memory; fall back on the zeroed pages,
+    // this CPU's first.
+    for(i = 0; i < ncpu && r == 0; i++)
+      r = ztake(&kcache[(me + i) % ncpu]);
+  }
+  popcli();
+  return (char*)r;
+}
+
+// Add a reference to the page at v, which kfree() then
+// only drops until the last one goes.
+void
+kshare(char *v)
+{
+  xadd(&PAGE(v)->share, 1);
+}
+
+// Is the page at v referenced more than once?
+int
+kshared(char *v)
+{
+  return PAGE(v)->share != 0;
+}
+
+// Allocate one zeroed page, preferably one zeroed
+// beforehand by kzero_idle().
+char*
+kzalloc(void)
+{
+  struct kcache *kc;
   struct run *r;
+  char *v;
+
+  if(kmem.use_lock){
+    pushcli();
+    kc = &kcache[cpuid()];
+    if((r = ztake(kc)) != 0){
+      kc->stat.zhit++;
+      r->next = 0;
+      popcli();
+      return (char*)r;
+    }
+    kc->stat.zmiss++;
+    popcli();
+  }
+
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Zero one free page for this CPU's kzalloc() pool.
+// Called by the scheduler when it has nothing to run.
+// Takes only pages that are free anyway: never from the
+// buffer cache, and not when memory runs low.
+void
+kzero_idle(void)
+{
+  struct kcache *kc;
+  struct run *r;
+
+  if(!kmem.use_lock)
+    return;
+
+  pushcli();
+  kc = &kcache[cpuid()];
+  r = 0;
+  if(kc->nzero < KZERO_TARGET && kfreepages() >= KZERO_FLOOR){
+    if(kc->freelist == 0)
+      krefill(kc);
+    if((r = kc->freelist) != 0){
+      kc->freelist = r->next;
+      kc->nfree--;
+    }
+  }
+  if(r){
+    memset(r, 0, PGSIZE);
+    acquire(&kc->zlock);
+    r->next = kc->zerolist;
+    kc->zerolist = r;
+    kc->nzero++;
+    release(&kc->zlock);
+  }
+  popcli();
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Returns 0 if no such block is free.
+char*
+kalloc_pages(int order)
+{
+  struct kcache *kc;
+  char *v;
+  int n;
+
+  if(order < 0 || order >= NORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
+
+  for(;;){
+    if(kmem.use_lock)
+      acquire(&kmem.lock);
+    v = buddy_alloc(order);
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    if(v || !kmem.use_lock)
+      return v;
+
+    // The buffer cache grows a page at a time and may hold
+    // pieces of every large block. Take some pages back and
+    // hand them, with the rest of this CPU's magazine, to
+    // the buddy allocator so they can coalesce.
+    pushcli();
+    kc = &kcache[cpuid()];
+    n = bshrink(KCACHE_BATCH);
+    if(kc->nfree > 0)
+      kdrain(kc, kc->nfree);
+    popcli();
+    if(n == 0)
+      return 0;
+  }
+}
+
+// Free a block returned by kalloc_pages(order).
+void
+kfree_pages(char *v, int order)
+{
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+
+  if(order < 0 || order >= NORDER || V2P(v) % BLKSIZE(order) ||
+     v < end || V2P(v) + BLKSIZE(order) > PHYSTOP)
+    panic("kfree_pages");
+  if(PAGE(v)->free || PAGE(v)->order != order)
+    panic("kfree_pages: not an allocated block");
+
+#ifdef KJUNK
+  memset(v, 1, BLKSIZE(order));
+#endif
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  buddy_free(v, order);
   if(kmem.use_lock)
     release(&kmem.lock);
-  return (char*)r;
 }
 
+// Turn the block of 2^order pages at v, returned by
+// kalloc_pages(order), into separate pages that are
+// each freed with kfree().
+void
+ksplit(char *v, int order)
+{
+  int i;
+
+  if(PAGE(v)->free || PAGE(v)->order != order)
+    panic("ksplit");
+  for(i = 0; i < (1 << order); i++){
+    PAGE(v + i*PGSIZE)->order = 0;
+    PAGE(v + i*PGSIZE)->share = 0;
+  }
+}
+
+// Copy the magazine counters of up to n CPUs to buf.
+// Returns the number of CPUs.
+int
+kcachestat(struct kcachestat *buf, int n)
+{
+  int i;
+
+  for(i = 0; i < n && i < ncpu; i++){
+    buf[i] = kcache[i].stat;
+    buf[i].cached = kcache[i].nfree;
+    buf[i].zeroed = kcache[i].nzero;
+  }
+  return ncpu;
+}
+
+// Fill in the physical memory totals of mi.
+void
+kmeminfo(struct meminfo *mi)
+{
+  int i;
+
+  mi->total = PHYSTOP / PGSIZE;
+  mi->kernel = PGROUNDUP(V2P(end)) / PGSIZE;
+  mi->cached = 0;
+  for(i = 0; i < ncpu; i++)
+    mi->cached += kcache[i].nfree + kcache[i].nzero;
+  mi->free = kmem.nfree + mi->cached;
+}
+
+// Return the number of free pages, without locking.
+uint
+kfreepages(void)
+{
+  uint n;
+  int i;
+
+  n = kmem.nfree;
+  for(i = 0; i < ncpu; i++)
+    n += kcache[i].nfree + kcache[i].nzero;
+  return n;
+}
+
+// Copy the buddy allocator counters to st.
+void
+kbuddystat(struct buddystat *st)
+{
+  acquire(&kmem.lock);
+  *st = kmem.stat;
+  st->freepages = kmem.nfree;
+  release(&kmem.lock);
+}
@@ -0,0 +1,113 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "kmemstat.h"
+
+// Show physical page allocator statistics.
+//   kmemstat        per-CPU page caches, buddy free lists, slab caches,
+//                   4MB pages of each process, buffer cache
+//   kmemstat -f N   the same, after forking N children
+//
+// For each order, frag% is the share of free memory in smaller
+// blocks, which can't serve an allocation of that order.
+
+struct kcachestat stats[NCPU];
+struct buddystat bstat;
+struct slabstat sstat[KMEM_NCACHE];
+struct superstat pstat[NPROC];
+struct bcachestat bcstat;
+
+int
+main(int argc, char *argv[])
+{
+  int n, i, nfork;
+  uint hit, miss, small;
+
+  if (argc >= 3 && strcmp(argv[1], "-f") == 0)
+  {
+    nfork = atoi(argv[2]);
+    for (i = 0; i < nfork; ++i)
+    {
+      n = fork();
+      if (n < 0)
+      {
+        printf(2, "kmemstat: fork failed\n");
+        break;
+      }
+      if (n == 0)
+        exit();
+      wait();
+    }
+  }
+
+  if ((n = kmemstat(KMEMSTAT_CPU, stats, NCPU)) < 0)
+  {
+    printf(2, "kmemstat: failed\n");
+    exit();
+  }
+
+  hit = miss = 0;
+  printf(1, "cpu: hit miss refill drain cached zhit zmiss zeroed\n");
+  for (i = 0; i < n; ++i)
+  {
+    printf(1, "%d: %d %d %d %d %d %d %d %d\n", i, stats[i].hit, stats[i].miss,
+           stats[i].refill, stats[i].drain, stats[i].cached,
+           stats[i].zhit, stats[i].zmiss, stats[i].zeroed);
+    hit += stats[i].hit;
+    miss += stats[i].miss;
+  }
+  if (hit + miss > 0)
+    printf(1, "hit rate: %d%%\n", hit * 100 / (hit + miss));
+
+  if (kmemstat(KMEMSTAT_BUDDY, &bstat, 1) < 0)
+  {
+    printf(2, "kmemstat: failed\n");
+    exit();
+  }
+
+  printf(1, "\n%d free pages\n", bstat.freepages);
+  printf(1, "order: free failed frag%%\n");
+  small = 0;
+  for (i = 0; i < KMEM_NORDER; ++i)
+  {
+    printf(1, "%d: %d %d %d\n", i, bstat.nfree[i], bstat.fail[i],
+           bstat.freepages ? small * 100 / bstat.freepages : 0);
+    small += bstat.nfree[i] << i;
+  }
+
+  if ((n = kmemstat(KMEMSTAT_SLAB, sstat, KMEM_NCACHE)) < 0)
+  {
+    printf(2, "kmemstat: failed\n");
+    exit();
+  }
+
+  printf(1, "\ncache: size pages objects\n");
+  for (i = 0; i < n; ++i)
+    printf(1, "%s: %d %d %d\n", sstat[i].name, sstat[i].size,
+           sstat[i].nslab, sstat[i].inuse);
+
+  if ((n = kmemstat(KMEMSTAT_SUPER, pstat, NPROC)) < 0)
+  {
+    printf(2, "kmemstat: failed\n");
+    exit();
+  }
+
+  printf(1, "\npid: 4MB promoted demoted\n");
+  for (i = 0; i < n; ++i)
+    printf(1, "%d: %d %d %d\n", pstat[i].pid, pstat[i].nsuper,
+           pstat[i].promote, pstat[i].demote);
+
+  if (kmemstat(KMEMSTAT_BCACHE, &bcstat, 1) < 0)
+  {
+    printf(2, "kmemstat: failed\n");
+    exit();
+  }
+
+  printf(1, "\nbcache: %d pages, hit %d miss %d grow %d shrink %d\n",
+         bcstat.pages, bcstat.hit, bcstat.miss, bcstat.grow, bcstat.shrink);
+  if (bcstat.hit + bcstat.miss > 0)
+    printf(1, "hit rate: %d%%\n", bcstat.hit * 100 / (bcstat.hit + bcstat.miss));
+
+  exit();
+}
@@ -0,0 +1,49 @@
+// Physical page allocator statistics, see the kmemstat system call.
+
+#define KMEM_NORDER  11  // buddy block orders 0..10 (4KB..4MB)
+#define KMEM_NCACHE  16  // maximum number of slab caches
+
+#define KMEMSTAT_CPU    0  // per-CPU page cache counters
+#define KMEMSTAT_BUDDY  1  // buddy allocator free lists
+#define KMEMSTAT_SLAB   2  // slab caches
+#define KMEMSTAT_SUPER  3  // per-process 4MB pages
+#define KMEMSTAT_BCACHE 4  // buffer cache
+
+struct kcachestat {
+  uint hit;          // kalloc served from the CPU's cache
+  uint miss;         // kalloc found the CPU's cache empty
+  uint refill;       // Batches taken from the global freelist
+  uint drain;        // Batches given back to the global freelist
+  uint cached;       // Pages now in the CPU's cache
+  uint zhit;         // kzalloc served a pre-zeroed page
+  uint zmiss;        // kzalloc had to zero a page itself
+  uint zeroed;       // Pre-zeroed pages now kept by the CPU
+};
+
+struct buddystat {
+  uint freepages;            // Pages on the buddy free lists
+  uint nfree[KMEM_NORDER];   // Free blocks of each order
+  uint fail[KMEM_NORDER];    // Failed allocations of each order
+};
+
+struct slabstat {
+  char name[16];     // Name of the cache
+  uint size;         // Object size
+  uint nslab;        // Pages used by the cache
+  uint inuse;        // Objects allocated
+};
+
+struct superstat {
+  int pid;
+  uint nsuper;       // 4MB pages mapped now
+  uint promote;      // 4MB pages mapped by page faults
+  uint demote;       // 4MB pages split into 4KB pages
+};
+
+struct bcachestat {
+  uint hit;          // Blocks found in the cache
+  uint miss;         // Blocks read from disk
+  uint grow;         // Pages added to the cache
+  uint shrink;       // Pages given back to kalloc
+  uint pages;        // Pages in the cache now
+};
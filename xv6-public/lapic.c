@@ -113,6 +113,16 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send interrupt vector to the CPU with APIC ID apicid.
+void
+lapicipi(uchar apicid, int vector)
+{
+  while(lapic[ICRLO] & DELIVS)
+    ;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
@@ -0,0 +1,90 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Multi-CPU lock throughput microbenchmark.
+// Workers call a system call that is short and dominated by
+// one kernel spinlock, and the total throughput is reported.
+//   time:   uptime()            -> tickslock (ticket lock)
+//   ptable: kill(nonexistent)   -> ptable.lock (MCS lock)
+//   kmem:   sbrk(+page), touch, sbrk(-page)
+//                               -> kalloc/kfree; kmem.lock (MCS lock)
+//                                  when the per-CPU magazine refills
+
+#define NITER     20000
+#define MAXWORKER 8
+
+static void
+work(char *kind)
+{
+  char *p;
+  int i;
+
+  for (i = 0; i < NITER; ++i)
+  {
+    if (kind[0] == 't')
+      uptime();
+    else if (kind[0] == 'p')
+      kill(-1);
+    else
+    {
+      // sbrk() is lazy: touch the page so it is allocated.
+      p = sbrk(4096);
+      *p = 1;
+      sbrk(-4096);
+    }
+  }
+}
+
+static void
+bench(char *kind, int nworker)
+{
+  int i, pid, start, elapsed;
+
+  start = uptime();
+  for (i = 0; i < nworker; ++i)
+  {
+    if ((pid = fork()) < 0)
+    {
+      printf(2, "lockbench: fork failed\n");
+      break;
+    }
+    if (pid == 0)
+    {
+      work(kind);
+      exit();
+    }
+  }
+  nworker = i;
+  for (i = 0; i < nworker; ++i)
+    wait();
+  elapsed = uptime() - start;
+
+  printf(1, "%s: %d workers x %d ops in %d ticks", kind, nworker, NITER, elapsed);
+  if (elapsed > 0)
+    printf(1, " (%d ops/tick)", nworker * NITER / elapsed);
+  printf(1, "\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, nworker = 4;
+  char *kinds[] = { "time", "ptable", "kmem" };
+
+  if (argc >= 2)
+    nworker = atoi(argv[1]);
+  if (nworker < 1 || nworker > MAXWORKER)
+  {
+    printf(2, "usage: lockbench [1-%d workers] [time|ptable|kmem]\n", MAXWORKER);
+    exit();
+  }
+
+  if (argc >= 3)
+    bench(argv[2], nworker);
+  else
+    for (n = 0; n < sizeof(kinds) / sizeof(kinds[0]); ++n)
+      bench(kinds[n], nworker);
+
+  exit();
+}
@@ -0,0 +1,69 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "lockstat.h"
+
+// Show kernel lock contention statistics.
+//   lockstat       dump the counters, most contended locks first
+//   lockstat -r    reset the counters
+// The kernel must be built with LOCKSTAT=1.
+
+struct lockstat stats[NLOCKSTAT];
+
+// Cycle counts are shown in units of 1024 cycles,
+// because printf can't print 64-bit numbers.
+#define KCYC(x) ((uint)((x) >> 10))
+
+int
+main(int argc, char *argv[])
+{
+  int n, i, j;
+  struct lockstat tmp, *ls;
+  struct locksite *s;
+
+  if (argc >= 2 && strcmp(argv[1], "-r") == 0)
+  {
+    if (lockstat(LOCKSTAT_RESET, 0, 0) < 0)
+    {
+      printf(2, "lockstat: kernel built without LOCKSTAT\n");
+      exit();
+    }
+    exit();
+  }
+
+  if ((n = lockstat(LOCKSTAT_DUMP, stats, NLOCKSTAT)) < 0)
+  {
+    printf(2, "lockstat: kernel built without LOCKSTAT\n");
+    exit();
+  }
+
+  // sort by contended acquisitions, then by acquisitions
+  for (i = 1; i < n; ++i)
+  {
+    for (j = i; j > 0; --j)
+    {
+      if (stats[j].contend < stats[j - 1].contend ||
+          (stats[j].contend == stats[j - 1].contend && stats[j].acquire <= stats[j - 1].acquire))
+        break;
+      tmp = stats[j];
+      stats[j] = stats[j - 1];
+      stats[j - 1] = tmp;
+    }
+  }
+
+  printf(1, "name (kind): acquired contended wait-kcyc hold-kcyc maxhold-kcyc\n");
+  for (ls = stats; ls < stats + n; ++ls)
+  {
+    if (ls->acquire == 0)
+      continue;
+
+    printf(1, "%s (%s): %d %d %d %d %d\n", ls->name, ls->sleep ? "sleep" : "spin",
+           ls->acquire, ls->contend, KCYC(ls->spin), KCYC(ls->hold), KCYC(ls->maxhold));
+
+    for (s = ls->sites; s < ls->sites + NLOCKSITE; ++s)
+      if (s->count > 0)
+        printf(1, "    %d from %p <- %p\n", s->count, s->pcs[0], s->pcs[1]);
+  }
+
+  exit();
+}
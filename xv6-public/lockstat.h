@@ -0,0 +1,25 @@
+// Lock contention statistics, see the lockstat system call.
+// Kept only in kernels built with LOCKSTAT defined.
+// Locks with the same name share one entry.
+
+#define NLOCKSTAT     32  // maximum number of lock names tracked
+#define NLOCKSITE      4  // contending call sites kept per lock name
+
+#define LOCKSTAT_DUMP  0  // copy out the statistics
+#define LOCKSTAT_RESET 1  // zero all counters
+
+struct locksite {
+  uint pcs[2];       // Caller of acquire and its caller
+  uint count;        // Contended acquisitions from there
+};
+
+struct lockstat {
+  char name[16];     // Name of the lock(s)
+  int sleep;         // Sleeplock rather than spinlock?
+  uint acquire;      // Number of acquisitions
+  uint contend;      // Acquisitions which had to wait
+  uint64 spin;       // TSC cycles spent waiting
+  uint64 hold;       // TSC cycles spent holding
+  uint64 maxhold;    // Longest hold in TSC cycles
+  struct locksite sites[NLOCKSITE]; // Top contending call sites
+};
@@ -3,6 +3,7 @@
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "mutex.h"
 #include "fs.h"
 #include "buf.h"
 
@@ -28,8 +28,11 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
+  slabinit();      // kernel object caches
   binit();         // buffer cache
   fileinit();      // file table
+  pipeinit();      // pipe cache
+  shminit();       // shared memory segments
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
@@ -64,9 +67,10 @@ static void
 startothers(void)
 {
   extern uchar _binary_entryother_start[], _binary_entryother_size[];
+  static char *stacks[NCPU];
   uchar *code;
   struct cpu *c;
-  char *stack;
+  int n;
 
   // Write entry code to unused memory at 0x7000.
   // The linker has placed the image of entryother.S in
@@ -74,24 +78,26 @@ startothers(void)
   code = P2V(0x7000);
   memmove(code, _binary_entryother_start, (uint)_binary_entryother_size);
 
-  for(c = cpus; c < cpus+ncpu; c++){
-    if(c == mycpu())  // We've started already.
-      continue;
+  // Tell entryother.S what stacks to use, where to enter, and what
+  // pgdir to use. We cannot use kpgdir yet, because the AP processor
+  // is running in low  memory, so we use entrypgdir for the APs too.
+  // Each AP takes the next stack in stacks[] as it comes up.
+  for(n = 0; n < ncpu-1; n++)
+    stacks[n] = kalloc() + KSTACKSIZE;
+  *(char***)(code-4) = stacks;
+  *(void(**)(void))(code-8) = mpenter;
+  *(int**)(code-12) = (void *) V2P(entrypgdir);
 
-    // Tell entryother.S what stack to use, where to enter, and what
-    // pgdir to use. We cannot use kpgdir yet, because the AP processor
-    // is running in low  memory, so we use entrypgdir for the APs too.
-    stack = kalloc();
-    *(void**)(code-4) = stack + KSTACKSIZE;
-    *(void(**)(void))(code-8) = mpenter;
-    *(int**)(code-12) = (void *) V2P(entrypgdir);
+  // Start all the APs, then wait for them, so that they
+  // boot in parallel.
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c != mycpu())  // We've started already.
+      lapicstartap(c->apicid, V2P(code));
 
-    lapicstartap(c->apicid, V2P(code));
-
-    // wait for cpu to finish mpmain()
-    while(c->started == 0)
+  // wait for each cpu to finish mpmain()
+  for(c = cpus; c < cpus+ncpu; c++)
+    while(c != mycpu() && c->started == 0)
       ;
-  }
 }
 
 // The boot page table used in entry.S and entryother.S.
@@ -0,0 +1,118 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Multi-threaded malloc/free throughput benchmark.
+// Each thread repeatedly allocates NOBJ blocks of mixed
+// sizes, fills them, checks them and frees them; the total
+// throughput is reported for 1, 2, 4 ... threads.
+//   mallocbench [max threads] [small|large]
+//   small:  16 to 1024 bytes, from the thread caches
+//   large:  64KB to 128KB, mmap()ed and unmapped
+
+#define NITER      200
+#define NOBJ       64
+#define MAXTHREAD  8
+
+static int large;
+static volatile int failed;
+
+static uint
+blocksize(uint *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  if (large)
+    return 64 * 1024 + (*seed >> 16) % (64 * 1024);
+  return 16 + (*seed >> 16) % 1009;
+}
+
+static void *
+worker(void *arg)
+{
+  char *p[NOBJ];
+  uint n[NOBJ];
+  uint seed, i, j;
+
+  seed = (uint)arg * 7919 + 1;
+  for (i = 0; i < NITER && !failed; ++i)
+  {
+    for (j = 0; j < NOBJ; ++j)
+    {
+      n[j] = blocksize(&seed);
+      if ((p[j] = malloc(n[j])) == 0)
+      {
+        failed = 1;
+        n[j] = 0;
+        continue;
+      }
+      p[j][0] = p[j][n[j] - 1] = (char)(j + (uint)arg);
+    }
+    for (j = 0; j < NOBJ; ++j)
+    {
+      if (p[j] == 0)
+        continue;
+      if (p[j][0] != (char)(j + (uint)arg) || p[j][n[j] - 1] != p[j][0])
+        failed = 2;
+      free(p[j]);
+    }
+  }
+  thread_exit(0);
+  return 0;
+}
+
+static void
+bench(int nthread)
+{
+  thread_t t[MAXTHREAD];
+  void *retval;
+  int i, start, elapsed, ops;
+
+  start = uptime();
+  for (i = 0; i < nthread; ++i)
+  {
+    if (thread_create(&t[i], worker, (void *)i) != 0)
+    {
+      printf(2, "mallocbench: thread_create failed\n");
+      break;
+    }
+  }
+  nthread = i;
+  for (i = 0; i < nthread; ++i)
+    thread_join(t[i], &retval);
+  elapsed = uptime() - start;
+
+  ops = nthread * NITER * NOBJ;
+  printf(1, "%s: %d threads x %d malloc/free in %d ticks",
+         large ? "large" : "small", nthread, NITER * NOBJ, elapsed);
+  if (elapsed > 0)
+    printf(1, " (%d ops/tick)", ops / elapsed);
+  printf(1, "\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, maxthread = 4;
+
+  if (argc >= 2)
+    maxthread = atoi(argv[1]);
+  if (maxthread < 1 || maxthread > MAXTHREAD)
+  {
+    printf(2, "usage: mallocbench [1-%d threads] [small|large]\n", MAXTHREAD);
+    exit();
+  }
+  if (argc >= 3 && argv[2][0] == 'l')
+    large = 1;
+
+  for (n = 1; n <= maxthread; n *= 2)
+  {
+    bench(n);
+    if (failed)
+    {
+      printf(2, "mallocbench: %s\n",
+             failed == 1 ? "out of memory" : "heap corrupted");
+      exit();
+    }
+  }
+  exit();
+}
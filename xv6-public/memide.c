@@ -10,6 +10,7 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "mutex.h"
 #include "fs.h"
 #include "buf.h"
 
@@ -40,7 +41,7 @@ iderw(struct buf *b)
 {
   uchar *p;
 
-  if(!holdingsleep(&b->lock))
+  if(!holdingmutex(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
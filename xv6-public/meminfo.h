@@ -0,0 +1,31 @@
+// Memory statistics, see the meminfo system call.
+// All sizes are in pages.
+
+struct meminfo {
+  uint total;        // Physical memory
+  uint kernel;       // Kernel image and the memory below it
+  uint free;         // Free, including the per-CPU caches
+  uint cached;       // Free pages held in per-CPU caches
+  uint pgtab;        // Page table pages
+  uint kstack;       // Kernel stacks
+  uint slab;         // Slab caches: files, inodes, pipes
+  uint pipe;         // Of which pipes
+  uint buf;          // Buffer cache data
+  uint user;         // User memory and everything else
+  uint swap;         // Swap area
+  uint swapfree;     // Free in the swap area
+};
+
+struct procmem {
+  int pid;
+  char name[16];
+  uint text;         // Program text and data
+  uint heap;         // Heap
+  uint stack;        // User stacks of threads
+  uint mmap;         // mmap() and shared memory areas
+  uint pgtab;        // Page table pages
+  uint kstack;       // Kernel stacks of threads
+  uint swap;         // Paged out to swap
+  uint swapin;       // Pages read back from swap, ever
+  uint swapout;      // Pages written to swap, ever
+};
@@ -6,7 +6,9 @@
 
 // Key addresses for address space layout (see kmap in vm.c for layout)
 #define KERNBASE 0x80000000         // First kernel virtual address
+#define MMAPBASE 0x40000000         // Start of mmap area, above the heap
 #define KERNLINK (KERNBASE+EXTMEM)  // Address where kernel is linked
+#define FWWINDOW (KERNBASE+PHYSTOP) // Boot-time view of firmware tables
 
 #define V2P(a) (((uint) (a)) - KERNBASE)
 #define P2V(a) ((void *)(((char *) (a)) + KERNBASE))
@@ -0,0 +1,11 @@
+// mmap() protection and flags
+
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+
+#define MAP_SHARED     0x01  // Write changes back to the file
+#define MAP_PRIVATE    0x02  // Keep changes in the process
+#define MAP_ANONYMOUS  0x04  // Zero-filled memory, no file
+#define MAP_FIXED      0x08  // Map exactly at addr
+
+#define MAP_FAILED     ((void*)-1)
@@ -14,6 +14,7 @@
 struct cpu cpus[NCPU];
 int ncpu;
 uchar ioapicid;
+uint ioapicaddr;
 
 static uchar
 sum(uchar *addr, int len)
@@ -98,6 +99,10 @@ mpinit(void)
   struct mpproc *proc;
   struct mpioapic *ioapic;
 
+  // Prefer the ACPI tables, which list any number of CPUs.
+  if(acpiinit() == 0)
+    return;
+
   if((conf = mpconfig(&mp)) == 0)
     panic("Expect to run on an SMP");
   ismp = 1;
@@ -115,6 +120,7 @@ mpinit(void)
     case MPIOAPIC:
       ioapic = (struct mpioapic*)p;
       ioapicid = ioapic->apicno;
+      ioapicaddr = (uint)ioapic->addr;
       p += sizeof(struct mpioapic);
       continue;
     case MPBUS:
@@ -0,0 +1,64 @@
+// Adaptive mutexes.
+//
+// A mutex is a sleeplock which doesn't go to sleep at once.
+// While the owner is running on another CPU, it is likely to
+// release the mutex soon, so spinning is cheaper than the
+// sleep/sched/wakeup round trip of acquiresleep. If the owner
+// is not running (e.g. it sleeps for disk I/O), or it doesn't
+// release the mutex within MUTEX_SPIN polls, fall back to
+// acquiresleep, which also lends our class to the owner.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "mutex.h"
+
+#define MUTEX_SPIN 1000  // max polls before blocking
+
+void
+initmutex(struct mutex *m, char *name)
+{
+  initsleeplock(&m->sl, name);
+  m->owner = 0;
+}
+
+void
+acquiremutex(struct mutex *m)
+{
+  struct thread *owner;
+  int i;
+
+  for(i = 0; i < MUTEX_SPIN; i++){
+    if(!m->sl.locked && tryacquiresleep(&m->sl))
+      goto acquired;
+
+    // A free mutex without owner is being released; poll again.
+    owner = m->owner;
+    if(owner != 0 && owner->state != RUNNING)
+      break;
+    pause();
+  }
+  acquiresleep(&m->sl);
+
+acquired:
+  m->owner = mythread();
+}
+
+void
+releasemutex(struct mutex *m)
+{
+  m->owner = 0;
+  releasesleep(&m->sl);
+}
+
+int
+holdingmutex(struct mutex *m)
+{
+  return holdingsleep(&m->sl);
+}
@@ -0,0 +1,5 @@
+// Adaptive mutexes for short critical sections
+struct mutex {
+  struct sleeplock sl;     // blocking part of the mutex
+  struct thread *owner;    // Thread holding the mutex, for spinning
+};
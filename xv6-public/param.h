@@ -1,15 +1,18 @@
 #define NPROC        64  // maximum number of processes
 #define NTHREAD   NPROC  // maximum number of threads per process
 #define KSTACKSIZE 4096  // size of per-process kernel stack
-#define NCPU          8  // maximum number of CPUs
+#define NCPU         64  // maximum number of CPUs
+#define NMCSLOCK      4  // maximum number of MCS spinlocks
+#define NIRQ         24  // IRQs with routing and counters
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // demand-paged memory areas per process
+#define NSHM         16  // shared memory segments
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
 #define FSSIZE       40000  // size of file system in blocks
+#define SWAPSIZE     16384  // size of swap area after it, in blocks
 
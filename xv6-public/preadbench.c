@@ -0,0 +1,83 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+// Benchmark of concurrent pread on a shared file.
+// Every worker reads the same small file block by block, so they
+// keep meeting on the same inode and buffer locks for short
+// critical sections.
+
+#define NBLOCK    16    // blocks in the shared file (fits in the cache)
+#define NITER     2000  // preads per worker
+#define MAXWORKER 8
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, j, pid;
+  int nworker = 4;
+  int start, end;
+  char *path = "preadbench.tmp";
+  char buf[512];
+
+  if (argc >= 2)
+    nworker = atoi(argv[1]);
+  if (nworker < 1 || nworker > MAXWORKER)
+  {
+    printf(2, "usage: preadbench [1-%d workers]\n", MAXWORKER);
+    exit();
+  }
+
+  memset(buf, 'x', sizeof buf);
+  fd = open(path, O_CREATE | O_RDWR);
+  if (fd < 0)
+  {
+    printf(2, "preadbench: cannot create %s\n", path);
+    exit();
+  }
+  for (i = 0; i < NBLOCK; ++i)
+  {
+    if (write(fd, buf, sizeof buf) != sizeof buf)
+    {
+      printf(2, "preadbench: write failed\n");
+      exit();
+    }
+  }
+
+  start = uptime();
+
+  for (i = 0; i < nworker; ++i)
+  {
+    if ((pid = fork()) < 0)
+    {
+      printf(2, "preadbench: fork failed\n");
+      break;
+    }
+
+    if (pid == 0)
+    {
+      for (j = 0; j < NITER; ++j)
+      {
+        if (pread(fd, buf, sizeof buf, ((i + j) % NBLOCK) * sizeof buf) != sizeof buf)
+        {
+          printf(2, "preadbench: pread failed\n");
+          break;
+        }
+      }
+      exit();
+    }
+  }
+
+  for (j = 0; j < i; ++j)
+    wait();
+
+  end = uptime();
+
+  printf(1, "%d workers, %d preads each: %d ticks\n", i, NITER, end - start);
+
+  close(fd);
+  unlink(path);
+
+  exit();
+}
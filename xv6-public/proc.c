@@ -6,6 +6,9 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "kmemstat.h"
+#include "meminfo.h"
 
 #define NUM_MLFQ_LEVEL 3
 #define MLFQ_CPU_SHARE 20
@@ -21,10 +24,19 @@
 #define STRIDE_TIME_QUANTUM 5
 #define STRIDE_TOTAL_TICKETS 100
 
+#define NPIDHASH NPROC
+#define NTIDHASH 256
+#define PIDHASH(pid) ((uint)(pid) % NPIDHASH)
+#define TIDHASH(tid) ((uint)(tid) % NTIDHASH)
+
 struct
 {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct proc *pidhash[NPIDHASH];   // pid -> live (non-UNUSED) process
+  struct thread *tidhash[NTIDHASH]; // tid -> live (non-UNUSED) thread
+  struct spinlock vmlock[NPROC];    // see lockvm()
+  int evicthand;                    // next process procevict() visits
 } ptable;
 
 typedef struct proc_queue
@@ -176,6 +188,26 @@ void stride_init()
   stride_mgr.pass = 0;
 }
 
+//! the part of p's share counted against STRIDE_TOTAL_TICKETS.
+//! a share lent by a sleeplock waiter is not: the waiter's own
+//! share, already counted, pays for it while the waiter sleeps.
+static int stride_admitted(struct proc *p)
+{
+  if (!p->inherited)
+    return p->stride.share;
+
+  return p->base_type == STRIDE ? p->base_share : 0;
+}
+
+//! how far the stride scheduler's pass advances per tick
+static double stride_step(void)
+{
+  if (stride_mgr.size == 0 || stride_mgr.share == 0)
+    return 0;
+
+  return STRIDE_TOTAL_TICKETS / (double)stride_mgr.share;
+}
+
 //! insert process to stride scheduler
 //! \param p process to insert
 //! \return 0 if success else -1
@@ -198,7 +230,7 @@ int stride_insert(struct proc *p)
     stride_mgr.list[j] = stride_mgr.list[j - 1];
   }
 
-  stride_mgr.share += p->stride.share;
+  stride_mgr.share += stride_admitted(p);
   stride_mgr.list[i] = p;
   ++stride_mgr.size;
 
@@ -207,7 +239,7 @@ int stride_insert(struct proc *p)
 
 void stride_remove_idx(int i)
 {
-  stride_mgr.share -= stride_mgr.list[i]->stride.share;
+  stride_mgr.share -= stride_admitted(stride_mgr.list[i]);
 
   for (; i < stride_mgr.size - 1; ++i)
     stride_mgr.list[i] = stride_mgr.list[i + 1];
@@ -323,8 +355,10 @@ int set_cpu_share(struct proc *p, int share)
 
   tickets = get_stride_total_tickets();
 
-  // if system has not enough tickets, return failure
-  if (share <= 0 || tickets + share > STRIDE_TOTAL_TICKETS)
+  // if system has not enough tickets, return failure.
+  // class of the process is borrowed while it inherits,
+  // so it cannot be changed until the lock is released.
+  if (share <= 0 || tickets + share > STRIDE_TOTAL_TICKETS || p->inherited)
   {
     release(&ptable.lock);
     return -1;
@@ -343,6 +377,212 @@ int set_cpu_share(struct proc *p, int share)
   return 0;
 }
 
+/****************************************
+ *  Priority inheritance for sleeplocks *
+ ****************************************/
+// A process sleeping on a sleeplock lends its scheduling class
+// to the holder: a stride waiter makes the holder a stride process
+// with (at least) its share, and a MLFQ waiter pulls the holder up
+// to its own level. The holder keeps its own class in base_* fields
+// and gets it back when it releases the lock.
+// Every function here must be called with ptable.lock held.
+
+// take p out of its scheduler
+static void sched_detach(struct proc *p)
+{
+  if (p->schedule_type == MLFQ)
+    mlfq_remove(p);
+  else if (p->schedule_type == STRIDE)
+    stride_remove(p);
+}
+
+static void sched_attach_mlfq(struct proc *p, int lev)
+{
+  p->schedule_type = MLFQ;
+  if (mlfq_enqueue(lev, p) != 0)
+    panic("cannot insert process at mlfq");
+}
+
+static void sched_attach_stride(struct proc *p, int share, double pass)
+{
+  p->schedule_type = STRIDE;
+  p->stride.share = share;
+  p->stride.pass = pass;
+  if (stride_insert(p) != 0)
+    panic("cannot insert process at stride");
+}
+
+//! lend the class of waiter to holder if it is higher
+static void pi_donate(struct proc *holder, struct proc *waiter)
+{
+  double pass;
+
+  if (holder == 0 || holder == waiter)
+    return;
+
+  if (waiter->schedule_type == STRIDE)
+  {
+    if (holder->schedule_type == STRIDE && holder->stride.share >= waiter->stride.share)
+      return;
+  }
+  else
+  {
+    if (holder->schedule_type == STRIDE || holder->mlfq.level <= waiter->mlfq.level)
+      return;
+  }
+
+  if (!holder->inherited)
+  {
+    holder->inherited = 1;
+    holder->base_type = holder->schedule_type;
+    if (holder->schedule_type == MLFQ)
+      holder->base_level = holder->mlfq.level;
+    else
+      holder->base_share = holder->stride.share;
+  }
+
+  // keep the pass of a stride holder, so it is not rewound
+  pass = holder->schedule_type == STRIDE ? holder->stride.pass : stride_mgr.pass;
+
+  sched_detach(holder);
+  if (waiter->schedule_type == STRIDE)
+    sched_attach_stride(holder, waiter->stride.share, pass);
+  else
+    sched_attach_mlfq(holder, waiter->mlfq.level);
+}
+
+//! give p its own class back, then take donations
+//! from the waiters of locks it still holds.
+static void pi_recompute(struct proc *p)
+{
+  struct sleeplock *lk;
+  struct slwaiter *w;
+  double pass;
+
+  if (p->inherited)
+  {
+    pass = p->schedule_type == STRIDE ? p->stride.pass : stride_mgr.pass;
+
+    sched_detach(p);
+    if (p->base_type == STRIDE)
+      sched_attach_stride(p, p->base_share, pass);
+    else
+      sched_attach_mlfq(p, p->base_level);
+
+    p->inherited = 0;
+  }
+
+  for (lk = p->heldlocks; lk != 0; lk = lk->nextheld)
+    for (w = lk->waiters; w != 0; w = w->next)
+      pi_donate(p, w->proc);
+}
+
+static void pi_link(struct sleeplock *lk, struct proc *p)
+{
+  if (lk->inheriting)
+    return;
+
+  lk->nextheld = p->heldlocks;
+  p->heldlocks = lk;
+  lk->inheriting = 1;
+}
+
+static void pi_unlink(struct sleeplock *lk, struct proc *p)
+{
+  struct sleeplock **pp;
+
+  if (!lk->inheriting)
+    return;
+
+  for (pp = &p->heldlocks; *pp != 0; pp = &(*pp)->nextheld)
+  {
+    if (*pp == lk)
+    {
+      *pp = lk->nextheld;
+      break;
+    }
+  }
+
+  lk->nextheld = 0;
+  lk->inheriting = 0;
+}
+
+//! called by a thread going to sleep on lk.
+//! w is registered as waiter unless it is null (already registered).
+//! lk->lk must be held.
+void pi_wait(struct sleeplock *lk, struct slwaiter *w)
+{
+  struct proc *p = myproc();
+
+  acquire(&ptable.lock);
+
+  if (w != 0)
+  {
+    w->next = lk->waiters;
+    lk->waiters = w;
+  }
+
+  if (lk->holder != 0)
+  {
+    pi_link(lk, lk->holder);
+    pi_donate(lk->holder, p);
+  }
+
+  release(&ptable.lock);
+}
+
+//! called by a waiter w which has just taken lk.
+//! lk->lk must be held.
+void pi_acquired(struct sleeplock *lk, struct slwaiter *w)
+{
+  struct slwaiter **pp;
+  struct proc *p = myproc();
+
+  acquire(&ptable.lock);
+
+  for (pp = &lk->waiters; *pp != 0; pp = &(*pp)->next)
+  {
+    if (*pp == w)
+    {
+      *pp = w->next;
+      break;
+    }
+  }
+
+  // remaining waiters now wait for us
+  if (lk->waiters != 0)
+  {
+    pi_link(lk, p);
+    for (w = lk->waiters; w != 0; w = w->next)
+      pi_donate(p, w->proc);
+  }
+
+  release(&ptable.lock);
+}
+
+static void wakeup1(void *chan);
+
+//! called by the holder releasing contended lk.
+//! unwinds what was inherited through lk and wakes up waiters.
+//! lk->lk must be held.
+void pi_release(struct sleeplock *lk)
+{
+  struct proc *p = lk->holder;
+
+  acquire(&ptable.lock);
+
+  if (p != 0)
+  {
+    pi_unlink(lk, p);
+    if (p->inherited)
+      pi_recompute(p);
+  }
+
+  wakeup1(lk);
+
+  release(&ptable.lock);
+}
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -350,63 +590,221 @@ int nexttid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
-static void wakeup1(void *chan);
-
 void pinit(void)
 {
-  initlock(&ptable.lock, "ptable");
+  struct proc *p;
+  struct thread *t;
+
+  initmcslock(&ptable.lock, "ptable");
+
+  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  {
+    initlock(&ptable.vmlock[p - ptable.proc], "vm");
+    for (t = p->threads; t < &p->threads[NTHREAD]; ++t)
+      t->proc = p;
+  }
 
   mlfq_init();
   stride_init();
 }
 
+// Serialize changes to p's user page table and size,
+// which the threads of p may make concurrently.
+// Doesn't sleep, so page faults may take it while
+// holding other spinlocks.
+void lockvm(struct proc *p)
+{
+  acquire(&ptable.vmlock[p - ptable.proc]);
+}
+
+void unlockvm(struct proc *p)
+{
+  release(&ptable.vmlock[p - ptable.proc]);
+}
+
 // Must be called with interrupts disabled
 int cpuid()
 {
   return mycpu() - cpus;
 }
 
-// Must be called with interrupts disabled to avoid the caller being
-// rescheduled between reading lapicid and running through the loop.
+// Must be called with interrupts disabled, so that the caller
+// is not rescheduled onto another CPU while using the result.
+// %gs points at the cpu-local fields of this CPU's struct cpu
+// (see seginit()), so each of these is a single load.
 struct cpu *
 mycpu(void)
 {
-  int apicid, i;
-
-  if (readeflags() & FL_IF)
-    panic("mycpu called with interrupts enabled\n");
+  struct cpu *c;
 
-  apicid = lapicid();
-  // APIC IDs are not guaranteed to be contiguous. Maybe we should have
-  // a reverse map, or reserve a register to store &cpus[i].
-  for (i = 0; i < ncpu; ++i)
-  {
-    if (cpus[i].apicid == apicid)
-      return &cpus[i];
-  }
-  panic("unknown apicid\n");
+  asm volatile("movl %%gs:0, %0" : "=r" (c));
+  return c;
 }
 
-// Disable interrupts so that we are not rescheduled
-// while reading proc from the cpu structure
+// The current process and thread are the same on whichever
+// CPU the caller runs, and a single load can't be split by
+// an interrupt, so these need not disable interrupts.
 struct proc *
 myproc(void)
 {
-  struct cpu *c;
   struct proc *p;
-  pushcli();
-  c = mycpu();
-  p = c->proc;
-  popcli();
+
+  asm volatile("movl %%gs:4, %0" : "=r" (p));
   return p;
 }
 
+struct thread *
+mythread(void)
+{
+  struct thread *t;
+
+  asm volatile("movl %%gs:8, %0" : "=r" (t));
+  return t;
+}
+
+//PAGEBREAK: 16
+// Lookup indexes of the process table.
+// All of them are protected by ptable.lock.
+
+static void
+pid_hash(struct proc *p)
+{
+  struct proc **pp = &ptable.pidhash[PIDHASH(p->pid)];
+
+  p->pidnext = *pp;
+  *pp = p;
+}
+
+static void
+pid_unhash(struct proc *p)
+{
+  struct proc **pp;
+
+  for (pp = &ptable.pidhash[PIDHASH(p->pid)]; *pp; pp = &(*pp)->pidnext)
+  {
+    if (*pp == p)
+    {
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  p->pidnext = 0;
+}
+
+static struct proc *
+pid_lookup(int pid)
+{
+  struct proc *p;
+
+  for (p = ptable.pidhash[PIDHASH(pid)]; p; p = p->pidnext)
+    if (p->pid == pid)
+      return p;
+  return 0;
+}
+
+static void
+tid_hash(struct thread *t)
+{
+  struct thread **pt = &ptable.tidhash[TIDHASH(t->tid)];
+
+  t->tidnext = *pt;
+  *pt = t;
+}
+
+static void
+tid_unhash(struct thread *t)
+{
+  struct thread **pt;
+
+  for (pt = &ptable.tidhash[TIDHASH(t->tid)]; *pt; pt = &(*pt)->tidnext)
+  {
+    if (*pt == t)
+    {
+      *pt = t->tidnext;
+      break;
+    }
+  }
+  t->tidnext = 0;
+}
+
+static struct thread *
+tid_lookup(thread_t tid)
+{
+  struct thread *t;
+
+  for (t = ptable.tidhash[TIDHASH(tid)]; t; t = t->tidnext)
+    if (t->tid == tid)
+      return t;
+  return 0;
+}
+
+// Link p into the children list of parent.
+static void
+child_link(struct proc *parent, struct proc *p)
+{
+  p->parent = parent;
+  p->sibling = parent->children;
+  parent->children = p;
+}
+
+static void
+child_unlink(struct proc *p)
+{
+  struct proc **pp;
+
+  if (p->parent == 0)
+    return;
+
+  for (pp = &p->parent->children; *pp; pp = &(*pp)->sibling)
+  {
+    if (*pp == p)
+    {
+      *pp = p->sibling;
+      break;
+    }
+  }
+  p->parent = 0;
+  p->sibling = 0;
+}
+
+// Drop p from the scheduler queues and the lookup indexes.
+// Caller must hold ptable.lock.
+static void
+unlinkproc(struct proc *p)
+{
+  struct thread *t;
+
+  if (p->schedule_type == MLFQ)
+  {
+    mlfq_remove(p);
+  }
+  else if (p->schedule_type == STRIDE)
+  {
+    stride_remove(p);
+
+    // to prevent overflow, if there is no stride process
+    // clear the pass values.
+    if (stride_mgr.size == 0)
+    {
+      mlfq_mgr.pass = 0;
+      stride_mgr.pass = 0;
+    }
+  }
+
+  pid_unhash(p);
+  for (t = p->threads; t < &p->threads[NTHREAD]; ++t)
+    if (t->state != UNUSED)
+      tid_unhash(t);
+
+  child_unlink(p);
+}
+
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
-static struct proc *
+struct proc *
 allocproc(void)
 {
   struct proc *p;
@@ -424,25 +822,39 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->nspromote = 0;
+  p->nsdemote = 0;
+  p->swaphand = 0;
+  p->nswapin = 0;
+  p->nswapout = 0;
 
   MAIN(p).state = EMBRYO;
   MAIN(p).tid = nexttid++;
+  MAIN(p).insyscall = 0;
 
   // scheduling init
   p->schedule_type = MLFQ;
   if (mlfq_enqueue(0, p) != 0)
   {
+    p->state = UNUSED;
+    MAIN(p).state = UNUSED;
     release(&ptable.lock);
     return 0;
   }
 
+  pid_hash(p);
+  tid_hash(&MAIN(p));
+
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if ((MAIN(p).kstack = kalloc()) == 0)
   {
+    acquire(&ptable.lock);
+    unlinkproc(p);
     p->state = UNUSED;
     MAIN(p).state = UNUSED;
+    release(&ptable.lock);
     return 0;
   }
   sp = MAIN(p).kstack + KSTACKSIZE;
@@ -466,6 +878,33 @@ found:
   return p;
 }
 
+// Give back a process from allocproc() that never ran.
+void freeproc(struct proc *np)
+{
+  kfree(MAIN(np).kstack);
+  MAIN(np).kstack = 0;
+  acquire(&ptable.lock);
+  unlinkproc(np);
+  np->state = UNUSED;
+  MAIN(np).state = UNUSED;
+  release(&ptable.lock);
+}
+
+// Make np, set up by the caller, a child of the current
+// process and let it run. Returns its pid.
+int startproc(struct proc *np)
+{
+  int pid;
+
+  pid = np->pid;
+  acquire(&ptable.lock);
+  child_link(myproc(), np);
+  np->state = RUNNABLE;
+  MAIN(np).state = RUNNABLE;
+  release(&ptable.lock);
+  return pid;
+}
+
 //PAGEBREAK: 32
 // Set up first user process.
 void userinit(void)
@@ -505,35 +944,39 @@ void userinit(void)
 }
 
 // Grow current process's memory by n bytes.
+// Growing only moves sz; pagefault() allocates the
+// pages when they are first touched.
 // Return 0 on success, -1 on failure.
 int growproc(int n)
 {
   uint sz;
   struct proc *curproc = myproc();
 
-  acquire(&ptable.lock);
+  lockvm(curproc);
 
   sz = curproc->sz;
   if (n > 0)
   {
-    if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if (sz + n < sz || sz + n > MMAPBASE)
     {
-      release(&ptable.lock);
+      unlockvm(curproc);
       return -1;
     }
+    sz += n;
   }
   else if (n < 0)
   {
-    if ((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if (splitsuper(curproc->pgdir, sz + n, sz) < 0 ||
+        (sz = shrinkuvm(curproc, sz, sz + n)) == 0)
     {
-      release(&ptable.lock);
+      unlockvm(curproc);
       return -1;
     }
+    trimvmas(curproc, sz);
   }
-  release(&ptable.lock);
-  
   curproc->sz = sz;
-  switchuvm(curproc);
+
+  unlockvm(curproc);
   return 0;
 }
 
@@ -546,6 +989,8 @@ int fork(void)
   struct proc *np;
   struct proc *curproc = myproc();
 
+  swapreclaim();
+
   // Allocate process.
   if ((np = allocproc()) == 0)
   {
@@ -553,18 +998,16 @@ int fork(void)
   }
 
   // Copy process state from proc.
-  if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0)
+  lockvm(curproc);
+  np->pgdir = copyuvm(curproc);
+  unlockvm(curproc);
+  if (np->pgdir == 0)
   {
-    kfree(MAIN(np).kstack);
-    MAIN(np).kstack = 0;
-    np->state = UNUSED;
-    MAIN(np).state = UNUSED;
-    np->state = UNUSED;
+    freeproc(np);
     return -1;
   }
   np->sz = curproc->sz;
-  np->parent = curproc;
-  *MAIN(np).tf = *RTHREAD(curproc).tf;
+  *MAIN(np).tf = *mythread()->tf;
 
   // Clear %eax so that fork returns 0 in the child.
   MAIN(np).tf->eax = 0;
@@ -573,6 +1016,7 @@ int fork(void)
     if (curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  dupvmas(np->vmas, curproc->vmas);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -580,13 +1024,15 @@ int fork(void)
   
   acquire(&ptable.lock);
 
+  child_link(curproc, np);
   np->state = RUNNABLE;
   MAIN(np).state = RUNNABLE;
 
   for (i = 0; i < NTHREAD; ++i)
     np->ustack_pool[i] = curproc->ustack_pool[i];
-  np->ustack_pool[0] = curproc->ustack_pool[curproc->curtid];
-  np->ustack_pool[curproc->curtid] = curproc->ustack_pool[0];
+  i = mythread() - curproc->threads;
+  np->ustack_pool[0] = curproc->ustack_pool[i];
+  np->ustack_pool[i] = curproc->ustack_pool[0];
 
   release(&ptable.lock);
 
@@ -616,8 +1062,12 @@ void exit(void)
     }
   }
 
+  // Write back shared file mappings.
+  msync(MMAPBASE, KERNBASE);
+
   begin_op();
   iput(curproc->cwd);
+  freevmas(curproc->vmas);
   end_op();
   curproc->cwd = 0;
 
@@ -627,14 +1077,12 @@ void exit(void)
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  while ((p = curproc->children) != 0)
   {
-    if (p->parent == curproc)
-    {
-      p->parent = initproc;
-      if (p->state == ZOMBIE)
-        wakeup1(initproc);
-    }
+    curproc->children = p->sibling;
+    child_link(initproc, p);
+    if (p->state == ZOMBIE)
+      wakeup1(initproc);
   }
 
   // Jump into the scheduler, never to return.
@@ -662,31 +1110,13 @@ int wait(void)
   acquire(&ptable.lock);
   for (;;)
   {
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    // Scan through children looking for exited ones.
+    havekids = curproc->children != 0;
+    for (p = curproc->children; p; p = p->sibling)
     {
-      if (p->parent != curproc)
-        continue;
-      havekids = 1;
       if (p->state == ZOMBIE)
       {
-        if (p->schedule_type == MLFQ)
-        {
-          mlfq_remove(p);
-        }
-        else if (p->schedule_type == STRIDE)
-        {
-          stride_remove(p);
-
-          // to prevent overflow, if there is no stride process
-          // clear the pass values.
-          if (stride_mgr.size == 0)
-          {
-            mlfq_mgr.pass = 0;
-            stride_mgr.pass = 0;
-          }
-        }
+        unlinkproc(p);
 
         // init thread data
         for (t = p->threads; t < &p->threads[NTHREAD]; ++t)
@@ -706,12 +1136,13 @@ int wait(void)
         pid = p->pid;
         freevm(p->pgdir);
         p->pid = 0;
-        p->parent = 0;
         p->name[0] = 0;
         p->killed = 0;
         p->state = UNUSED;
 
         // init schedule data
+        p->inherited = 0;
+        p->heldlocks = 0;
         p->schedule_type = MLFQ;
         p->stride.pass = 0;
         p->stride.share = 0;
@@ -758,7 +1189,7 @@ void incr_ticks(struct proc *p, int dbg)
     if (dbg != 0)
     {
       p->stride.pass += STRIDE_TOTAL_TICKETS / (double)p->stride.share;
-      stride_mgr.pass += (stride_mgr.size > 0) * STRIDE_TOTAL_TICKETS / (double)stride_mgr.share;
+      stride_mgr.pass += stride_step();
     }
   }
 }
@@ -840,6 +1271,8 @@ void mlfq_boosting()
       mlfq_enqueue(0, p);
 
       p->executed_ticks = 0;
+      if (p->inherited && p->base_type == MLFQ)
+        p->base_level = 0;
     }
   }
 
@@ -851,7 +1284,7 @@ stride_choose()
 {
   struct proc *p;
 
-  stride_mgr.pass += (stride_mgr.size > 0) * STRIDE_TOTAL_TICKETS / (double)stride_mgr.share;
+  stride_mgr.pass += stride_step();
 
   if (stride_pop(&p) != 0)
     return 0;
@@ -933,6 +1366,7 @@ void scheduler(void)
       // to release ptable.lock and then reacquire it
       // before jumping back to us.
       c->proc = p;
+      c->thread = t;
       switchuvm(p);
       t->state = RUNNING;
 
@@ -942,10 +1376,12 @@ void scheduler(void)
 
       swtch(&(c->scheduler), t->context);
       switchkvm();
+      tlbleave(p);
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
       c->proc = 0;
+      c->thread = 0;
     }
 
     if (mlfq_mgr.executed_ticks >= MLFQ_BOOSTING_INTERVAL)
@@ -954,6 +1390,10 @@ void scheduler(void)
     }
 
     release(&ptable.lock);
+
+    // Nothing to run; zero free pages meanwhile.
+    if (p == 0)
+      kzero_idle();
   }
 }
 
@@ -967,8 +1407,7 @@ void scheduler(void)
 void sched(void)
 {
   int intena;
-  struct proc *p = myproc();
-  struct thread *t = &RTHREAD(p);
+  struct thread *t = mythread();
 
   if (!holding(&ptable.lock))
     panic("sched ptable.lock");
@@ -988,11 +1427,11 @@ static void shift_thread(struct proc *p)
 {
   int intena;
   struct thread *t;
-  struct thread *curthread = &RTHREAD(p);
+  struct thread *curthread = mythread();
 
   acquire(&ptable.lock);
 
-  for (t = &p->threads[(p->curtid + 1) % NTHREAD]; ; ++t)
+  for (t = curthread + 1; ; ++t)
   {
     if (t == &p->threads[NTHREAD])
       t = p->threads;
@@ -1023,6 +1462,7 @@ static void shift_thread(struct proc *p)
 
   // switchuvm for thread
   pushcli();
+  mycpu()->thread = t;
   mycpu()->ts.esp0 = (uint)t->kstack + KSTACKSIZE;
   popcli();
 
@@ -1039,7 +1479,7 @@ static void shift_process(struct proc *p)
 {
   acquire(&ptable.lock); //DOC: yieldlock
   p->state = RUNNABLE;
-  RTHREAD(p).state = RUNNABLE;
+  mythread()->state = RUNNABLE;
   sched();
   release(&ptable.lock);
 }
@@ -1083,6 +1523,7 @@ void forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    swapinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -1093,7 +1534,7 @@ void forkret(void)
 void sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
-  struct thread *t = &RTHREAD(p);
+  struct thread *t = mythread();
 
   if (p == 0)
     panic("sleep");
@@ -1162,22 +1603,20 @@ int kill(int pid)
   struct thread *t;
 
   acquire(&ptable.lock);
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  if ((p = pid_lookup(pid)) == 0)
   {
-    if (p->pid == pid)
-    {
-      p->killed = 1;
-      // Wake threads from sleep if necessary.
-      for (t = p->threads; t < &p->threads[NTHREAD]; ++t)
-        if (t->state == SLEEPING)
-          t->state = RUNNABLE;
-
-      release(&ptable.lock);
-      return 0;
-    }
+    release(&ptable.lock);
+    return -1;
   }
+
+  p->killed = 1;
+  // Wake threads from sleep if necessary.
+  for (t = p->threads; t < &p->threads[NTHREAD]; ++t)
+    if (t->state == SLEEPING)
+      t->state = RUNNABLE;
+
   release(&ptable.lock);
-  return -1;
+  return 0;
 }
 
 //PAGEBREAK: 36
@@ -1217,6 +1656,127 @@ void procdump(void)
   }
 }
 
+// Fill in mi, and the memory use of up to n processes in
+// pm. Returns the number of processes filled in.
+int procmeminfo(struct meminfo *mi, struct procmem *pm, int n)
+{
+  struct proc *p;
+  struct thread *t;
+  struct procmem m;
+  int k;
+
+  kmeminfo(mi);
+  swapinfo(mi);
+  mi->pgtab = kvmpages();
+  mi->kstack = 0;
+  mi->slab = kslabpages(0);
+  mi->pipe = kslabpages("pipe");
+  mi->buf = bcachepages();
+
+  k = 0;
+  acquire(&ptable.lock);
+  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  {
+    if (p->state == UNUSED)
+      continue;
+    memset(&m, 0, sizeof(m));
+    for (t = p->threads; t < &p->threads[NTHREAD]; t++)
+      if (t->kstack)
+        m.kstack++;
+    if (p->pgdir && p->state != ZOMBIE)
+      uvmstat(p, &m);
+    m.swapin = p->nswapin;
+    m.swapout = p->nswapout;
+    mi->pgtab += m.pgtab;
+    mi->kstack += m.kstack;
+    if (k < n)
+    {
+      m.pid = p->pid;
+      safestrcpy(m.name, p->name, sizeof(m.name));
+      pm[k++] = m;
+    }
+  }
+  release(&ptable.lock);
+
+  mi->user = mi->total - mi->kernel - mi->free - mi->pgtab -
+             mi->kstack - mi->slab - mi->buf;
+  return k;
+}
+
+// Can procevict() take pages from p? Not while p runs,
+// as another CPU's TLB may hold its PTEs, nor while one
+// of its threads is in a system call, as the kernel may
+// touch user memory holding a spinlock, and can't page
+// it back in then. Caller must hold ptable.lock.
+static int evictable(struct proc *p)
+{
+  struct thread *t;
+  int i;
+
+  if (p->state != RUNNABLE || p->pgdir == 0)
+    return 0;
+  for (i = 0; i < ncpu; i++)
+    if (cpus[i].proc == p)
+      return 0;
+  for (t = p->threads; t < &p->threads[NTHREAD]; t++)
+    if (t->state == RUNNING ||
+        (t->state != UNUSED && t->state != ZOMBIE && t->insyscall))
+      return 0;
+  return 1;
+}
+
+// Take up to n pages to page out, to the free swap
+// slots in slot, from the next process that allows it,
+// with uvmevict(). Returns the number k of pages, put in
+// mem; they go to the first k slots.
+int procevict(char **mem, uint *slot, int n)
+{
+  struct proc *p;
+  int i, k;
+
+  k = 0;
+  acquire(&ptable.lock);
+  for (i = 0; i < NPROC; i++)
+  {
+    p = &ptable.proc[ptable.evicthand];
+    ptable.evicthand = (ptable.evicthand + 1) % NPROC;
+    if (!evictable(p))
+      continue;
+    lockvm(p);
+    k = uvmevict(p, mem, slot, n);
+    unlockvm(p);
+    break;
+  }
+  release(&ptable.lock);
+  return k;
+}
+
+// Copy the 4MB page counters of up to n processes to buf.
+// Returns the number copied.
+int procsuperstat(struct superstat *buf, int n)
+{
+  struct proc *p;
+  int i, k;
+
+  k = 0;
+  acquire(&ptable.lock);
+  for (p = ptable.proc; p < &ptable.proc[NPROC] && k < n; p++)
+  {
+    if (p->state == UNUSED || p->state == EMBRYO || p->state == ZOMBIE)
+      continue;
+    buf[k].pid = p->pid;
+    buf[k].nsuper = 0;
+    for (i = 0; i < PDX(KERNBASE); i++)
+      if (p->pgdir[i] & PTE_PS)
+        buf[k].nsuper++;
+    buf[k].promote = p->nspromote;
+    buf[k].demote = p->nsdemote;
+    k++;
+  }
+  release(&ptable.lock);
+  return k;
+}
+
 
 /****************************************
  *  Thread (Light Weight Process)       *
@@ -1229,6 +1789,8 @@ int thread_create(thread_t *thread, void *(*start_routine)(void*), void *arg)
   uint sz;
   int tidx;
 
+  swapreclaim();
+
   acquire(&ptable.lock);
 
   for (nt = curproc->threads; nt < &curproc->threads[NTHREAD]; ++nt)
@@ -1244,6 +1806,7 @@ found:
   tidx = nt - curproc->threads;
   nt->state = EMBRYO;
   nt->tid = nexttid++;
+  nt->insyscall = 0;
 
   // Allocate kernel stack.
   if ((nt->kstack = kalloc()) == 0)
@@ -1256,7 +1819,7 @@ found:
   // Leave room for trap frame.
   sp -= sizeof *nt->tf;
   nt->tf = (struct trapframe *)sp;
-  *nt->tf = *RTHREAD(curproc).tf;
+  *nt->tf = *mythread()->tf;
 
   // Set up new context to start executing at forkret,
   // which returns to trapret.
@@ -1271,15 +1834,18 @@ found:
   // Allocate user stack.
   if (curproc->ustack_pool[tidx] == 0)
   {
+    lockvm(curproc);
     sz = PGROUNDUP(curproc->sz);
     if ((sz = allocuvm(curproc->pgdir, sz, sz + PGSIZE)) == 0)
     {
+      unlockvm(curproc);
       cprintf("cannot alloc user stack\n");
       goto bad;
     }
 
     curproc->ustack_pool[tidx] = sz;
     curproc->sz = sz;
+    unlockvm(curproc);
   }
   sp = (char *)curproc->ustack_pool[tidx];
 
@@ -1297,6 +1863,7 @@ found:
 
   *thread = nt->tid;
 
+  tid_hash(nt);
   nt->state = RUNNABLE;
 
   release(&ptable.lock);
@@ -1315,8 +1882,7 @@ bad:
 
 void thread_exit(void *retval)
 {
-  struct proc *curproc = myproc();
-  struct thread *curthread = &RTHREAD(curproc);
+  struct thread *curthread = mythread();
 
   acquire(&ptable.lock);
 
@@ -1331,22 +1897,16 @@ void thread_exit(void *retval)
 
 int thread_join(thread_t thread, void **retval)
 {
-  struct proc *p;
   struct thread *t;
 
   acquire(&ptable.lock);
 
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; ++p)
-    if (p->state == RUNNABLE)
-      for (t = p->threads; t < &p->threads[NTHREAD]; ++t)
-        if (t->state != UNUSED && t->tid == thread)
-          goto found;
-
-  release(&ptable.lock);
-
-  return -1;
+  if ((t = tid_lookup(thread)) == 0 || t->proc->state != RUNNABLE)
+  {
+    release(&ptable.lock);
+    return -1;
+  }
 
-found:
   if (t->state != ZOMBIE)
   {
     sleep((void*)thread, &ptable.lock);
@@ -1356,6 +1916,7 @@ found:
     *retval = t->retval;
 
   // clean up thread
+  tid_unhash(t);
   kfree(t->kstack);
   t->kstack = 0;
   t->retval = 0;
@@ -1366,3 +1927,43 @@ found:
 
   return 0;
 }
+
+// Make the calling thread the only thread of p, as its main
+// thread. Other threads are discarded. Called by exec.
+void thread_collapse(struct proc *p)
+{
+  struct thread *t, *cur = mythread();
+
+  acquire(&ptable.lock);
+
+  if (cur != &MAIN(p))
+  {
+    tid_unhash(&MAIN(p));
+    tid_unhash(cur);
+    if (MAIN(p).kstack)
+      kfree(MAIN(p).kstack);
+    MAIN(p) = *cur;
+    cur->kstack = 0;
+    cur->state = UNUSED;
+    tid_hash(&MAIN(p));
+    mycpu()->thread = &MAIN(p);
+  }
+  p->curtid = 0;
+
+  for (t = &p->threads[1]; t < &p->threads[NTHREAD]; ++t)
+  {
+    if (t->state != UNUSED)
+      tid_unhash(t);
+    if (t->kstack)
+      kfree(t->kstack);
+
+    t->kstack = 0;
+    t->state = UNUSED;
+    t->tid = 0;
+    t->retval = 0;
+
+    p->ustack_pool[t - p->threads] = 0;
+  }
+
+  release(&ptable.lock);
+}
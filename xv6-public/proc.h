@@ -1,5 +1,17 @@
+// Queue node of a MCS spinlock. A CPU spins on its own node
+// of the lock, so waiters don't bounce the lock's cache line.
+struct mcsnode {
+  struct mcsnode *next;      // Next CPU in queue
+  volatile uint wait;        // Set until the previous CPU hands over
+};
+
 // Per-CPU state
 struct cpu {
+  // Per-CPU variables, which the kernel reads at %gs:0,
+  // %gs:4 and %gs:8 (see seginit()).
+  struct cpu *cpu;           // This cpu
+  struct proc *proc;         // The process running on this cpu or null
+  struct thread *thread;     // The thread of proc running on this cpu
   uchar apicid;              // Local APIC ID
   struct context *scheduler; // swtch() here to enter scheduler
   struct taskstate ts;       // Used by x86 to find stack for interrupt
@@ -7,7 +19,9 @@ struct cpu {
   volatile uint started;     // Has the CPU started?
   int ncli;                  // Depth of pushcli nesting.
   int intena;                // Were interrupts enabled before pushcli?
-  struct proc *proc;         // The process running on this cpu or null
+  struct mcsnode mcs[NMCSLOCK]; // Queue nodes for MCS spinlocks
+  uint nintr[NIRQ];          // Interrupts taken, by IRQ
+  volatile uint tlbwork;     // Has a TLB shootdown to do (see tlb.c)
 };
 
 extern struct cpu cpus[NCPU];
@@ -55,21 +69,52 @@ struct thread {
   struct trapframe *tf;       // Trap frame for current syscall
   struct context *context;    // swtch() here to run process
   void *chan;                 // If non-zero, sleeping on chan
+  int insyscall;              // In a system call? See procevict()
 
   void *retval;               // Return value of this thread
+
+  struct proc *proc;          // Process this thread belongs to
+  struct thread *tidnext;     // Next thread in tid hash chain
 };
 
+// An area of process memory paged in by pagefault() on
+// first touch: a program segment, or an mmap() mapping
+// at or above MMAPBASE.
+struct vma {
+  uint start;                 // First address, page aligned
+  uint end;                   // End address, page aligned
+  int flags;                  // VMA_*; 0 if slot unused
+  struct inode *ip;           // Backing file; 0 if anonymous
+  struct shm *shm;            // Shared memory segment, or 0
+  uint off;                   // File offset of start
+  uint filesz;                // Bytes of the file from start; rest is zero
+};
+
+#define VMA_USED    0x1
+#define VMA_WRITE   0x2       // Mapped writable
+#define VMA_SHARED  0x4       // Shared with children; writes go to the file
+
 // Per-process state
 struct proc {
   uint sz;                    // Size of process memory (bytes)
   pde_t *pgdir;               // Page table
+  volatile uint cpumask[NCPU/32]; // CPUs that may cache pgdir (see tlb.c)
   enum procstate state;       // Process state
   int pid;                    // Process ID
   struct proc *parent;        // Parent process
   int killed;                 // If non-zero, have been killed
   struct file *ofile[NOFILE]; // Open files
   struct inode *cwd;          // Current directory
+  struct vma vmas[NVMA];      // Demand-paged memory areas
+  uint nspromote;             // 4MB pages mapped
+  uint nsdemote;              // 4MB pages split into 4KB pages
+  uint swaphand;              // Where uvmevict() goes on
+  uint nswapin;               // Pages read back from swap
+  uint nswapout;              // Pages written to swap
   char name[16];              // Process name (debugging)
+  struct proc *pidnext;       // Next process in pid hash chain
+  struct proc *children;      // First child process
+  struct proc *sibling;       // Next child of parent
 
   // informations for scheduling
   enum schedule_policy schedule_type;
@@ -79,16 +124,24 @@ struct proc {
     struct stride_info stride;
   };
 
+  // informations for priority inheritance
+  struct sleeplock *heldlocks; // contended sleeplocks held by this process
+  int inherited;               // running with a class lent by a waiter?
+  enum schedule_policy base_type;
+  int base_level;
+  int base_share;
+
   // informations for threads
   struct thread threads[NTHREAD];
   uint  ustack_pool[NTHREAD];
-  thread_t curtid;
+  thread_t curtid;             // Scheduling cursor; see mythread()
 };
 
 // Main thread of the process
 #define MAIN(p) ((p)->threads[0])
 
-// Recently executed thread
+// Thread the scheduler chose last. With threads of p on
+// several CPUs this need not be the caller's: use mythread().
 #define RTHREAD(p) ((p)->threads[(p)->curtid])
 
 // Process memory is laid out contiguously, low addresses first:
@@ -3,6 +3,7 @@
 #include "types.h"
 #include "user.h"
 #include "fcntl.h"
+#include "spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -52,6 +53,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 void
@@ -130,6 +132,88 @@ runcmd(struct cmd *cmd)
   exit();
 }
 
+// Can cmd be run with spawn() alone? Lists and background
+// commands need a forked copy of the shell.
+int
+spawnable(struct cmd *cmd)
+{
+  switch(cmd->type){
+  case EXEC:
+    return 1;
+  case REDIR:
+    return spawnable(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    return spawnable(((struct pipecmd*)cmd)->left) &&
+           spawnable(((struct pipecmd*)cmd)->right);
+  }
+  return 0;
+}
+
+// Start the programs of spawnable cmd, applying the nact
+// file actions in act before cmd's own redirections.
+// Returns the number of children to wait for.
+int
+spawncmd(struct cmd *cmd, struct spawnact *act, int nact)
+{
+  int p[2], n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+  struct spawnact pact[NSPAWNACT];
+
+  switch(cmd->type){
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    if(spawn(ecmd->argv[0], ecmd->argv, act, nact) < 0){
+      printf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if(nact == NSPAWNACT)
+      panic("too many redirections");
+    act[nact].type = SPAWN_OPEN;
+    act[nact].fd = rcmd->fd;
+    act[nact].path = rcmd->file;
+    act[nact].mode = rcmd->mode;
+    return spawncmd(rcmd->cmd, act, nact+1);
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(nact + 3 > NSPAWNACT)
+      panic("too many redirections");
+    if(pipe(p) < 0)
+      panic("pipe");
+    memmove(pact, act, nact*sizeof(act[0]));
+    pact[nact].type = SPAWN_DUP;
+    pact[nact].fd = 1;
+    pact[nact].src = p[1];
+    pact[nact+1].type = SPAWN_CLOSE;
+    pact[nact+1].fd = p[0];
+    pact[nact+2].type = SPAWN_CLOSE;
+    pact[nact+2].fd = p[1];
+    n = spawncmd(pcmd->left, pact, nact+3);
+    memmove(pact, act, nact*sizeof(act[0]));
+    pact[nact].type = SPAWN_DUP;
+    pact[nact].fd = 0;
+    pact[nact].src = p[0];
+    pact[nact+1].type = SPAWN_CLOSE;
+    pact[nact+1].fd = p[0];
+    pact[nact+2].type = SPAWN_CLOSE;
+    pact[nact+2].fd = p[1];
+    n += spawncmd(pcmd->right, pact, nact+3);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+  panic("spawncmd");
+  return 0;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,7 +229,9 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  static struct spawnact act[NSPAWNACT];
+  struct cmd *cmd;
+  int fd, n;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,9 +250,20 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    // Commands, redirections and pipes are started with
+    // spawn(), which doesn't copy the shell.
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if(spawnable(cmd)){
+      for(n = spawncmd(cmd, act, 0); n > 0; n--)
+        wait();
+      freecmd(cmd);
+      continue;
+    }
     if(fork1() == 0)
-      runcmd(parsecmd(buf));
+      runcmd(cmd);
     wait();
+    freecmd(cmd);
   }
   exit();
 }
@@ -258,6 +355,20 @@ backcmd(struct cmd *subcmd)
 }
 //PAGEBREAK!
 // Parsing
+//
+// The shell parses commands itself, so parse errors are
+// reported with syntax(), not panic(), and parsecmd()
+// returns 0.
+
+int parseerr;
+
+void
+syntax(char *msg)
+{
+  if(!parseerr)
+    printf(2, "%s\n", msg);
+  parseerr = 1;
+}
 
 char whitespace[] = " \t\r\n\v";
 char symbols[] = "<|>&;()";
@@ -331,11 +442,16 @@ parsecmd(char *s)
   struct cmd *cmd;
 
   es = s + strlen(s);
+  parseerr = 0;
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     printf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(parseerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +495,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +523,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +551,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +615,29 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free the nodes of cmd.
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
@@ -0,0 +1,208 @@
+// Named shared memory segments.
+//
+// shm_open() finds or creates a segment by name and returns
+// its id; shm_attach() maps it into the process as a shared
+// area (see shmattach() in vm.c). Each attachment holds a
+// reference, passed on to children by fork() and dropped by
+// shm_detach(), exec() and exit(); the segment is freed
+// when the last one goes. A segment never attached is freed
+// when its slot is needed for another.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#define SHMMAXPG  256    // pages per segment
+#define SHMNAME   16     // bytes in a name, with the 0
+
+struct shm {
+  char name[SHMNAME];
+  int ref;               // Attachments
+  int used;              // Was it ever attached?
+  uint gen;              // Bumped when the slot is reused
+  uint npage;
+  char *pages[SHMMAXPG];
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shmtab");
+}
+
+// Free the pages of s. Caller must hold shmtab.lock.
+static void
+shmfree(struct shm *s)
+{
+  uint i;
+
+  for(i = 0; i < s->npage; i++)
+    kfree(s->pages[i]);
+  s->npage = 0;
+  s->name[0] = 0;
+  s->ref = 0;
+  s->used = 0;
+  s->gen++;
+}
+
+// Find the segment called name. If there is none, set
+// *slot to a slot to create it in, or 0 if all are taken.
+// Caller must hold shmtab.lock.
+static struct shm*
+shmlookup(char *name, struct shm **slot)
+{
+  struct shm *s, *empty, *idle;
+
+  empty = idle = 0;
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++){
+    if(s->npage == 0){
+      if(empty == 0)
+        empty = s;
+      continue;
+    }
+    if(strncmp(s->name, name, sizeof(s->name)) == 0)
+      return s;
+    if(s->ref == 0 && !s->used && idle == 0)
+      idle = s;
+  }
+  *slot = empty ? empty : idle;
+  return 0;
+}
+
+// Free a list of pages chained through their first word.
+static void
+freechain(char *list)
+{
+  char *p;
+
+  while((p = list) != 0){
+    list = *(char**)p;
+    kfree(p);
+  }
+}
+
+// Find the segment called name, or create it with size
+// bytes of zeroed memory. Returns 0 if the name is too
+// long, if the segment exists but is smaller than size,
+// or if out of segments or memory.
+struct shm*
+shmopen(char *name, uint size)
+{
+  struct shm *s, *slot;
+  char *list, *p;
+  uint i, n;
+
+  n = PGROUNDUP(size) / PGSIZE;
+  if(name[0] == 0 || strlen(name) >= SHMNAME || n == 0 || n > SHMMAXPG)
+    return 0;
+
+  acquire(&shmtab.lock);
+  s = shmlookup(name, &slot);
+  release(&shmtab.lock);
+  if(s)
+    return n <= s->npage ? s : 0;
+
+  // Zero the pages without holding the lock, chained
+  // through their first word.
+  list = 0;
+  for(i = 0; i < n; i++){
+    if((p = kzalloc()) == 0){
+      freechain(list);
+      return 0;
+    }
+    *(char**)p = list;
+    list = p;
+  }
+
+  // Another process may have created the segment meanwhile.
+  acquire(&shmtab.lock);
+  if((s = shmlookup(name, &slot)) != 0 || slot == 0){
+    release(&shmtab.lock);
+    freechain(list);
+    if(s)
+      return n <= s->npage ? s : 0;
+    return 0;
+  }
+  s = slot;
+  if(s->npage)
+    shmfree(s);
+  while((p = list) != 0){
+    list = *(char**)p;
+    *(char**)p = 0;
+    s->pages[s->npage++] = p;
+  }
+  safestrcpy(s->name, name, sizeof(s->name));
+  release(&shmtab.lock);
+  return s;
+}
+
+// Return the id of s for user code.
+int
+shmid(struct shm *s)
+{
+  return s->gen * NSHM + (s - shmtab.shm);
+}
+
+// Take a reference to the segment with the given id.
+// Returns 0 if there is no such segment.
+struct shm*
+shmget(int id)
+{
+  struct shm *s;
+
+  if(id < 0)
+    return 0;
+  acquire(&shmtab.lock);
+  s = &shmtab.shm[id % NSHM];
+  if(s->npage == 0 || s->gen != id / NSHM){
+    release(&shmtab.lock);
+    return 0;
+  }
+  s->ref++;
+  s->used = 1;
+  release(&shmtab.lock);
+  return s;
+}
+
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  s->ref++;
+  release(&shmtab.lock);
+}
+
+// Drop a reference to s, freeing it with the last one.
+void
+shmput(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  if(s->ref < 1)
+    panic("shmput");
+  if(--s->ref == 0)
+    shmfree(s);
+  release(&shmtab.lock);
+}
+
+uint
+shmsize(struct shm *s)
+{
+  return s->npage * PGSIZE;
+}
+
+// Return page i of s, which must be referenced.
+char*
+shmpage(struct shm *s, uint i)
+{
+  if(i >= s->npage)
+    panic("shmpage");
+  return s->pages[i];
+}
@@ -0,0 +1,262 @@
+// Slab allocator for small kernel objects.
+//
+// A cache hands out objects of one size. Objects are carved
+// from slabs, single pages from kalloc() that start with a
+// struct slab header; the slab of an object is found by
+// rounding the object's address down to a page boundary.
+//
+// Each CPU keeps a magazine of free objects per cache, so
+// most allocations and frees don't take the cache's lock.
+// An empty magazine takes SLAB_BATCH objects from the slabs;
+// a full one gives SLAB_BATCH back.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "kmemstat.h"
+
+#define SLAB_MAG    16   // objects in a CPU's magazine
+#define SLAB_BATCH  (SLAB_MAG / 2)
+
+struct slab {
+  struct slab *next;     // Slabs of the cache
+  struct slab *prev;
+  struct kmem_cache *cache;
+  void **freelist;       // Free objects in this slab
+  uint inuse;            // Objects handed out from this slab
+};
+
+struct magazine {
+  void *objs[SLAB_MAG];
+  int n;
+};
+
+struct kmem_cache {
+  char name[16];
+  uint size;             // Object size, rounded up
+  uint perslab;          // Objects per slab
+  struct spinlock lock;
+  struct slab *partial;  // Slabs with free objects
+  struct slab *full;     // Slabs without free objects
+  uint nslab;
+  struct magazine mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[KMEM_NCACHE];
+  int ncache;
+} slabtab;
+
+#define SLABHDR   ((sizeof(struct slab) + 7) & ~7)
+
+void
+slabinit(void)
+{
+  initlock(&slabtab.lock, "slabtab");
+}
+
+// Create a cache of objects of the given size.
+// Panics if out of caches or if size doesn't fit a slab.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 7) & ~7;
+  if(size < sizeof(void*) || size > PGSIZE - SLABHDR)
+    panic("kmem_cache_create: size");
+
+  acquire(&slabtab.lock);
+  if(slabtab.ncache == KMEM_NCACHE)
+    panic("kmem_cache_create: no caches");
+  c = &slabtab.cache[slabtab.ncache++];
+  release(&slabtab.lock);
+
+  safestrcpy(c->name, name, sizeof(c->name));
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  initlock(&c->lock, "slab");
+  return c;
+}
+
+static void
+slab_link(struct slab **head, struct slab *s)
+{
+  s->prev = 0;
+  s->next = *head;
+  if(s->next)
+    s->next->prev = s;
+  *head = s;
+}
+
+static void
+slab_unlink(struct slab **head, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *head = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Allocate and carve a new slab for c.
+// Caller must hold c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+  uint i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->freelist = 0;
+  obj = (char*)s + SLABHDR;
+  for(i = 0; i < c->perslab; i++, obj += c->size){
+    *(void**)obj = s->freelist;
+    s->freelist = (void**)obj;
+  }
+  slab_link(&c->partial, s);
+  c->nslab++;
+  return s;
+}
+
+// Move up to SLAB_BATCH objects from c's slabs to m.
+static void
+mag_refill(struct kmem_cache *c, struct magazine *m)
+{
+  struct slab *s;
+  void **obj;
+
+  acquire(&c->lock);
+  while(m->n < SLAB_BATCH){
+    if((s = c->partial) == 0 && (s = slab_grow(c)) == 0)
+      break;
+    obj = s->freelist;
+    s->freelist = *obj;
+    s->inuse++;
+    if(s->freelist == 0){
+      slab_unlink(&c->partial, s);
+      slab_link(&c->full, s);
+    }
+    m->objs[m->n++] = obj;
+  }
+  release(&c->lock);
+}
+
+// Move SLAB_BATCH objects from m back to their slabs.
+// A slab left empty is freed if c has another partial slab.
+static void
+mag_drain(struct kmem_cache *c, struct magazine *m)
+{
+  struct slab *s;
+  void **obj;
+  int i;
+
+  acquire(&c->lock);
+  for(i = 0; i < SLAB_BATCH; i++){
+    obj = m->objs[--m->n];
+    s = (struct slab*)PGROUNDDOWN((uint)obj);
+    if(s->freelist == 0){
+      slab_unlink(&c->full, s);
+      slab_link(&c->partial, s);
+    }
+    *obj = s->freelist;
+    s->freelist = obj;
+    if(--s->inuse == 0 && (s->prev || s->next)){
+      slab_unlink(&c->partial, s);
+      c->nslab--;
+      kfree((char*)s);
+    }
+  }
+  release(&c->lock);
+}
+
+// Allocate an object from c.
+// Returns 0 if out of memory.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj;
+
+  obj = 0;
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0)
+    mag_refill(c, m);
+  if(m->n > 0)
+    obj = m->objs[--m->n];
+  popcli();
+  return obj;
+}
+
+// Free an object returned by kmem_cache_alloc(c).
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+  if(((struct slab*)PGROUNDDOWN((uint)obj))->cache != c)
+    panic("kmem_cache_free");
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == SLAB_MAG)
+    mag_drain(c, m);
+  m->objs[m->n++] = obj;
+  popcli();
+}
+
+// Return the pages used by the cache called name,
+// or by all caches if name is 0.
+uint
+kslabpages(char *name)
+{
+  struct kmem_cache *c;
+  uint n;
+
+  n = 0;
+  acquire(&slabtab.lock);
+  for(c = slabtab.cache; c < &slabtab.cache[slabtab.ncache]; c++)
+    if(name == 0 || strncmp(c->name, name, sizeof(c->name)) == 0)
+      n += c->nslab;
+  release(&slabtab.lock);
+  return n;
+}
+
+// Copy statistics of up to n caches to buf.
+// Returns the number of caches.
+int
+kslabstat(struct slabstat *buf, int n)
+{
+  struct kmem_cache *c;
+  struct slab *s;
+  int i, j;
+
+  acquire(&slabtab.lock);
+  for(i = 0; i < n && i < slabtab.ncache; i++){
+    c = &slabtab.cache[i];
+    safestrcpy(buf[i].name, c->name, sizeof(buf[i].name));
+    buf[i].size = c->size;
+    acquire(&c->lock);
+    buf[i].nslab = c->nslab;
+    buf[i].inuse = c->perslab * c->nslab;
+    for(s = c->partial; s; s = s->next)
+      buf[i].inuse -= c->perslab - s->inuse;
+    release(&c->lock);
+    for(j = 0; j < ncpu; j++)
+      buf[i].inuse -= c->mag[j].n;
+  }
+  n = slabtab.ncache;
+  release(&slabtab.lock);
+  return n;
+}
@@ -9,6 +9,7 @@
 #include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "lockstat.h"
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
@@ -17,27 +18,98 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->holder = 0;
+  lk->waiters = 0;
+  lk->nextheld = 0;
+  lk->inheriting = 0;
+#ifdef LOCKSTAT
+  lk->stat = lockstat_register(name, 1);
+#endif
 }
 
+// While sleeping, the waiter lends its scheduling class
+// to the holder (see pi_wait in proc.c), so a holder in
+// a low MLFQ level can't keep a stride process waiting.
 void
 acquiresleep(struct sleeplock *lk)
 {
+  struct slwaiter w;
+  int waited = 0;
+#ifdef LOCKSTAT
+  uint64 start = rdtsc();
+  uint pcs[10];
+#endif
+
   acquire(&lk->lk);
-  while (lk->locked) {
-    sleep(lk, &lk->lk);
+  if (lk->locked) {
+    waited = 1;
+    w.proc = myproc();
+    pi_wait(lk, &w);
+    while (lk->locked) {
+      sleep(lk, &lk->lk);
+      if (lk->locked)
+        pi_wait(lk, 0);
+    }
+    lk->locked = 1;
+    lk->pid = myproc()->pid;
+    lk->holder = myproc();
+    pi_acquired(lk, &w);
+  } else {
+    lk->locked = 1;
+    lk->pid = myproc()->pid;
+    lk->holder = myproc();
   }
-  lk->locked = 1;
-  lk->pid = myproc()->pid;
   release(&lk->lk);
+
+#ifdef LOCKSTAT
+  getcallerpcs(&lk, pcs);
+  lk->tsc = rdtsc();
+  lockstat_acquired(lk->stat, waited, lk->tsc - start, pcs);
+#else
+  (void)waited;
+#endif
+}
+
+// Take the lock only if it is free; never sleeps.
+// Returns 1 if the lock was acquired.
+int
+tryacquiresleep(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = !lk->locked;
+  if (r) {
+    lk->locked = 1;
+    lk->pid = myproc()->pid;
+    lk->holder = myproc();
+  }
+  release(&lk->lk);
+
+#ifdef LOCKSTAT
+  if (r) {
+    lk->tsc = rdtsc();
+    lockstat_acquired(lk->stat, 0, 0, 0);
+  }
+#endif
+  return r;
 }
 
 void
 releasesleep(struct sleeplock *lk)
 {
+#ifdef LOCKSTAT
+  lockstat_released(lk->stat, rdtsc() - lk->tsc);
+#endif
+
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  // Nobody sleeps on an uncontended lock,
+  // so there is nothing to undo or wake up.
+  if (lk->waiters || lk->inheriting)
+    pi_release(lk);
+  lk->holder = 0;
   release(&lk->lk);
 }
 
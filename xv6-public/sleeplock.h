@@ -2,9 +2,26 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
-  
+
+  // For priority inheritance.
+  // Changed only with both lk and ptable.lock held.
+  struct proc *holder;        // Process holding lock
+  struct slwaiter *waiters;   // Processes sleeping on this lock
+  struct sleeplock *nextheld; // Next contended lock of holder
+  int inheriting;             // Linked on holder->heldlocks?
+
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+#ifdef LOCKSTAT
+  struct lockstat *stat; // Statistics shared by locks of this name
+  uint64 tsc;        // When the lock was acquired
+#endif
 };
 
+// An entry of sleeplock's waiter list.
+// It lives on the kernel stack of the sleeping thread.
+struct slwaiter {
+  struct proc *proc;
+  struct slwaiter *next;
+};
@@ -0,0 +1,16 @@
+// File actions for spawn(), applied in order to a copy
+// of the caller's open files before the child starts.
+
+#define SPAWN_CLOSE  1   // close fd
+#define SPAWN_DUP    2   // make fd a copy of src
+#define SPAWN_OPEN   3   // open path with mode as fd
+
+#define NSPAWNACT    16  // maximum actions per spawn
+
+struct spawnact {
+  int type;
+  int fd;
+  int src;           // SPAWN_DUP
+  char *path;        // SPAWN_OPEN
+  int mode;          // SPAWN_OPEN, O_* flags
+};
@@ -0,0 +1,81 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Compare starting a program with fork+exec and with spawn.
+//   spawnbench [n [mb]]
+// Starts n (default 200) children running "spawnbench -x",
+// which exits at once, each way. The parent first touches
+// mb (default 4) megabytes of heap, which fork has to share
+// with every child and spawn doesn't.
+
+#define PGSIZE 4096
+
+static char *childargv[] = { "spawnbench", "-x", 0 };
+
+static int
+viafork(void)
+{
+  int pid;
+
+  if ((pid = fork()) == 0)
+  {
+    exec(childargv[0], childargv);
+    exit();
+  }
+  return pid;
+}
+
+static int
+viaspawn(void)
+{
+  return spawn(childargv[0], childargv, 0, 0);
+}
+
+static void
+bench(char *name, int (*start)(void), int n)
+{
+  int i, t0, elapsed;
+
+  t0 = uptime();
+  for (i = 0; i < n; ++i)
+  {
+    if (start() < 0)
+    {
+      printf(2, "spawnbench: %s failed\n", name);
+      break;
+    }
+    wait();
+  }
+  elapsed = uptime() - t0;
+
+  printf(1, "%s: %d children in %d ticks", name, i, elapsed);
+  if (elapsed > 0)
+    printf(1, " (%d/tick)", i / elapsed);
+  printf(1, "\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, mb, i;
+  char *heap;
+
+  if (argc >= 2 && strcmp(argv[1], "-x") == 0)
+    exit();
+
+  n = argc >= 2 ? atoi(argv[1]) : 200;
+  mb = argc >= 3 ? atoi(argv[2]) : 4;
+
+  if ((heap = sbrk(mb * 1024 * 1024)) == (char *)-1)
+  {
+    printf(2, "spawnbench: sbrk failed\n");
+    exit();
+  }
+  for (i = 0; i < mb * 1024 * 1024; i += PGSIZE)
+    heap[i] = 1;
+
+  bench("fork+exec", viafork, n);
+  bench("spawn", viaspawn, n);
+  exit();
+}
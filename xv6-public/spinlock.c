@@ -8,13 +8,114 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "lockstat.h"
+
+// Pauses per waiter ahead of us in a ticket lock.
+#define TICKET_BACKOFF 32
+
+static int nmcslock;
 
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
+  lk->tail = 0;
+  lk->mcs = 0;
   lk->cpu = 0;
+#ifdef LOCKSTAT
+  lk->stat = lockstat_register(name, 0);
+#endif
+}
+
+// Make a MCS lock, for the most contended locks.
+// Each CPU needs a queue node per MCS lock,
+// so there can be only NMCSLOCK of them.
+void
+initmcslock(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+  if(nmcslock >= NMCSLOCK)
+    panic("initmcslock");
+  lk->mcs = ++nmcslock;
+}
+
+// Is the lock held by any cpu?
+static int
+locked(struct spinlock *lk)
+{
+  if(lk->mcs)
+    return lk->tail != 0;
+  return lk->next != lk->owner;
+}
+
+// Take a ticket and wait for it to be served.
+// Tickets are served in order, so no CPU starves.
+// Returns 1 if it had to wait.
+static int
+ticket_acquire(struct spinlock *lk)
+{
+  uint ticket, owner;
+  int i, waited;
+
+  ticket = xadd(&lk->next, 1);
+  waited = 0;
+  while((owner = *(volatile uint*)&lk->owner) != ticket){
+    // The holder may be waiting for us to flush our TLB.
+    tlbpoll();
+    // Back off in proportion to our place in line.
+    for(i = (ticket - owner) * TICKET_BACKOFF; i > 0; i--)
+      pause();
+    waited = 1;
+  }
+  return waited;
+}
+
+static void
+ticket_release(struct spinlock *lk)
+{
+  // Only the holder writes owner, so no atomic op is needed.
+  asm volatile("incl %0" : "+m" (lk->owner) : );
+}
+
+// Append this cpu's node to the queue and spin on it
+// until the previous holder hands the lock over.
+// Returns 1 if it had to wait.
+static int
+mcs_acquire(struct spinlock *lk)
+{
+  struct mcsnode *me, *prev;
+
+  me = &mycpu()->mcs[lk->mcs - 1];
+  me->next = 0;
+  me->wait = 1;
+  prev = (struct mcsnode*)xchg((uint*)&lk->tail, (uint)me);
+  if(prev == 0)
+    return 0;
+  *(struct mcsnode* volatile*)&prev->next = me;
+  while(me->wait){
+    tlbpoll();
+    pause();
+  }
+  return 1;
+}
+
+static void
+mcs_release(struct spinlock *lk)
+{
+  struct mcsnode *me, *next;
+
+  me = &mycpu()->mcs[lk->mcs - 1];
+  if((next = *(struct mcsnode* volatile*)&me->next) == 0){
+    // No one queued behind us: empty the queue.
+    if(cmpxchg((uint*)&lk->tail, (uint)me, 0) == (uint)me)
+      return;
+    // Someone is queueing; wait for it to link itself.
+    while((next = *(struct mcsnode* volatile*)&me->next) == 0)
+      pause();
+  }
+  next->wait = 0;
 }
 
 // Acquire the lock.
@@ -24,13 +125,20 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  int waited;
+#ifdef LOCKSTAT
+  uint64 start = rdtsc();
+#endif
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  // The xadd and xchg are atomic.
+  if(lk->mcs)
+    waited = mcs_acquire(lk);
+  else
+    waited = ticket_acquire(lk);
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +148,13 @@ acquire(struct spinlock *lk)
   // Record info about lock acquisition for debugging.
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+
+#ifdef LOCKSTAT
+  lk->tsc = rdtsc();
+  lockstat_acquired(lk->stat, waited, lk->tsc - start, lk->pcs);
+#else
+  (void)waited;
+#endif
 }
 
 // Release the lock.
@@ -49,6 +164,10 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+#ifdef LOCKSTAT
+  lockstat_released(lk->stat, rdtsc() - lk->tsc);
+#endif
+
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
@@ -59,10 +178,11 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code can't use a C assignment, since it might
-  // not be atomic. A real OS would use C atomics here.
-  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  // Hand the lock to the next waiter.
+  if(lk->mcs)
+    mcs_release(lk);
+  else
+    ticket_release(lk);
 
   popcli();
 }
@@ -91,7 +211,7 @@ holding(struct spinlock *lock)
 {
   int r;
   pushcli();
-  r = lock->locked && lock->cpu == mycpu();
+  r = locked(lock) && lock->cpu == mycpu();
   popcli();
   return r;
 }
@@ -124,3 +244,138 @@ popcli(void)
     sti();
 }
 
+#ifdef LOCKSTAT
+// Statistics of every lock name, for the lockstat system call.
+// Entries are only appended, under statlock, which is a bare flag
+// because spinlocks are initialized before mycpu() works.
+// Counters are updated with atomic adds, as each entry is shared
+// by all the locks of the same name.
+static struct lockstat lockstats[NLOCKSTAT];
+static int nlockstat;
+static uint statlock;
+
+// Return the entry for locks named name; 0 if the table is full.
+struct lockstat*
+lockstat_register(char *name, int sleep)
+{
+  struct lockstat *ls;
+
+  while(xchg(&statlock, 1) != 0)
+    pause();
+
+  for(ls = lockstats; ls < lockstats + nlockstat; ls++)
+    if(ls->sleep == sleep && strncmp(ls->name, name, sizeof(ls->name) - 1) == 0)
+      goto found;
+
+  ls = 0;
+  if(nlockstat < NLOCKSTAT){
+    ls = &lockstats[nlockstat++];
+    safestrcpy(ls->name, name, sizeof(ls->name));
+    ls->sleep = sleep;
+  }
+
+found:
+  xchg(&statlock, 0);
+  return ls;
+}
+
+// Count an acquisition which waited for wait cycles if it was
+// contended. pcs is the call stack of the acquirer.
+void
+lockstat_acquired(struct lockstat *ls, int contended, uint64 wait, uint *pcs)
+{
+  struct locksite *s, *min;
+
+  if(ls == 0)
+    return;
+
+  __sync_fetch_and_add(&ls->acquire, 1);
+  if(!contended)
+    return;
+  __sync_fetch_and_add(&ls->contend, 1);
+  __sync_fetch_and_add(&ls->spin, wait);
+
+  // Keep the most contending call sites: a new site takes
+  // over the least counted slot and inherits its count, so
+  // heavy sites can't be pushed out by a stream of rare ones.
+  min = ls->sites;
+  for(s = ls->sites; s < ls->sites + NLOCKSITE; s++){
+    if(s->pcs[0] == pcs[0] && s->pcs[1] == pcs[1]){
+      __sync_fetch_and_add(&s->count, 1);
+      return;
+    }
+    if(s->count < min->count)
+      min = s;
+  }
+  min->pcs[0] = pcs[0];
+  min->pcs[1] = pcs[1];
+  min->count++;
+}
+
+// Count a release after holding the lock for hold cycles.
+void
+lockstat_released(struct lockstat *ls, uint64 hold)
+{
+  if(ls == 0)
+    return;
+
+  __sync_fetch_and_add(&ls->hold, hold);
+  if(hold > ls->maxhold)
+    ls->maxhold = hold;
+}
+
+// Copy up to n entries to dst; returns the number copied.
+int
+lockstat_dump(struct lockstat *dst, int n)
+{
+  if(n > nlockstat)
+    n = nlockstat;
+  memmove(dst, lockstats, n * sizeof(struct lockstat));
+  return n;
+}
+
+int
+lockstat_reset(void)
+{
+  struct lockstat *ls;
+
+  for(ls = lockstats; ls < lockstats + nlockstat; ls++){
+    ls->acquire = 0;
+    ls->contend = 0;
+    ls->spin = 0;
+    ls->hold = 0;
+    ls->maxhold = 0;
+    memset(ls->sites, 0, sizeof(ls->sites));
+  }
+  return 0;
+}
+#else
+struct lockstat*
+lockstat_register(char *name, int sleep)
+{
+  return 0;
+}
+
+void
+lockstat_acquired(struct lockstat *ls, int contended, uint64 wait, uint *pcs)
+{
+}
+
+void
+lockstat_released(struct lockstat *ls, uint64 hold)
+{
+}
+
+// Lock statistics are not compiled in.
+int
+lockstat_dump(struct lockstat *dst, int n)
+{
+  return -1;
+}
+
+int
+lockstat_reset(void)
+{
+  return -1;
+}
+#endif
@@ -1,11 +1,19 @@
 // Mutual exclusion lock.
+// A ticket lock, or a MCS queue lock if made by initmcslock.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out
+  uint owner;        // Ticket now served; held if next != owner
+  struct mcsnode *tail; // Last CPU queued on a MCS lock
+  int mcs;           // 1 + index of per-cpu MCS node, 0 if ticket lock
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+#ifdef LOCKSTAT
+  struct lockstat *stat; // Statistics shared by locks of this name
+  uint64 tsc;        // When the lock was acquired
+#endif
 };
 
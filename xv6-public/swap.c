@@ -0,0 +1,210 @@
+// Swap space for user pages.
+//
+// mkfs reserves sb.nswap blocks at sb.swapstart, after the
+// file system; each slot of SWAPBLKS blocks holds a page.
+// When free memory runs low, swapreclaim() has procevict()
+// pick cold pages of the processes in turn, with a clock
+// scan that gives pages with PTE_A set a second chance,
+// and writes them out. The PTE of a paged-out page holds
+// PTE_SWAP and the slot instead of PTE_P; pagefault()
+// reads the page back on the next touch.
+//
+// A slot is referenced by the PTEs holding it (fork()
+// shares it like a copy-on-write page), and by a fault
+// reading it back. It is busy while its page is being
+// written out; readers wait for the write to finish.
+// swap.lock is taken with ptable.lock and lockvm() held,
+// so readers sleep on swap.iolock instead, which is
+// never taken holding other locks.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "mutex.h"
+#include "fs.h"
+#include "buf.h"
+#include "meminfo.h"
+
+#define SWAPBLKS   (PGSIZE / BSIZE)          // blocks per slot
+#define NSWAPSLOT  (SWAPSIZE / SWAPBLKS)
+#define SWAPLOW    256   // free pages below which to reclaim
+#define SWAPBATCH  16    // pages written per scan
+
+struct {
+  struct spinlock lock;
+  struct spinlock iolock;  // Protects busy
+  uint dev;
+  uint start;            // First block of the swap area
+  uint nslot;            // Slots in the swap area
+  uint nfree;
+  uint hint;             // Where to look for a free slot
+  uchar ref[NSWAPSLOT];  // References to each slot
+  uchar busy[NSWAPSLOT]; // Is the slot being written?
+} swap;
+
+void
+swapinit(int dev)
+{
+  struct superblock sb;
+
+  initlock(&swap.lock, "swap");
+  initlock(&swap.iolock, "swapio");
+  readsb(dev, &sb);
+  swap.dev = dev;
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap / SWAPBLKS;
+  if(swap.nslot > NSWAPSLOT)
+    swap.nslot = NSWAPSLOT;
+  swap.nfree = swap.nslot;
+  cprintf("swap: %d pages at block %d\n", swap.nslot, swap.start);
+}
+
+// Allocate a slot, busy until swapdone().
+// Returns -1 if the swap area is full.
+static int
+swapalloc(void)
+{
+  uint i, s;
+
+  acquire(&swap.iolock);
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    s = (swap.hint + i) % swap.nslot;
+    if(swap.ref[s] == 0 && !swap.busy[s]){
+      swap.ref[s] = 1;
+      swap.busy[s] = 1;
+      swap.nfree--;
+      swap.hint = s + 1;
+      release(&swap.lock);
+      release(&swap.iolock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  release(&swap.iolock);
+  return -1;
+}
+
+// Slot s has been written, or won't be.
+static void
+swapdone(uint s)
+{
+  acquire(&swap.iolock);
+  swap.busy[s] = 0;
+  wakeup(&swap.busy[s]);
+  release(&swap.iolock);
+}
+
+void
+swapdup(uint s)
+{
+  acquire(&swap.lock);
+  if(swap.ref[s] == 255)
+    panic("swapdup");
+  swap.ref[s]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot s, freeing it with the last.
+void
+swapput(uint s)
+{
+  acquire(&swap.lock);
+  if(swap.ref[s] < 1)
+    panic("swapput");
+  if(--swap.ref[s] == 0)
+    swap.nfree++;
+  release(&swap.lock);
+}
+
+// Read or write the page at mem from or to slot s,
+// a block at a time, bypassing the buffer cache.
+static void
+swapio(uint s, char *mem, int write)
+{
+  struct buf b;
+  int i;
+
+  memset(&b, 0, sizeof(b));
+  initmutex(&b.lock, "swapbuf");
+  acquiremutex(&b.lock);
+  b.dev = swap.dev;
+  for(i = 0; i < SWAPBLKS; i++){
+    b.blockno = swap.start + s*SWAPBLKS + i;
+    b.data = (uchar*)mem + i*BSIZE;
+    b.flags = write ? B_DIRTY : 0;
+    iderw(&b);
+  }
+  releasemutex(&b.lock);
+}
+
+// Read slot s into the page at mem. The caller holds
+// a reference to s.
+void
+swapread(uint s, char *mem)
+{
+  acquire(&swap.iolock);
+  while(swap.busy[s])
+    sleep(&swap.busy[s], &swap.iolock);
+  release(&swap.iolock);
+  swapio(s, mem, 0);
+}
+
+// Write out up to n pages chosen by procevict(), and
+// free them. Returns the number written.
+static int
+swapout(int n)
+{
+  char *mem[SWAPBATCH];
+  uint slot[SWAPBATCH];
+  int i, k, s;
+
+  if(n > SWAPBATCH)
+    n = SWAPBATCH;
+  for(i = 0; i < n && (s = swapalloc()) >= 0; i++)
+    slot[i] = s;
+  n = i;
+
+  k = procevict(mem, slot, n);
+  for(i = 0; i < k; i++){
+    swapio(slot[i], mem[i], 1);
+    swapdone(slot[i]);
+    kfree(mem[i]);
+  }
+  for(; i < n; i++){
+    swapput(slot[i]);
+    swapdone(slot[i]);
+  }
+  return k;
+}
+
+// If free memory is low, shrink the buffer and inode
+// caches, then page out cold pages until there are 2*SWAPLOW free
+// pages or every process has been visited twice.
+// Called before allocating user memory, where the
+// kernel may sleep.
+void
+swapreclaim(void)
+{
+  uint free;
+  int i;
+
+  if((free = kfreepages()) >= SWAPLOW)
+    return;
+  bshrink(2*SWAPLOW - free);
+  ishrink(2*SWAPLOW - free);
+  for(i = 0; i < 2*NPROC && kfreepages() < 2*SWAPLOW; i++)
+    swapout(SWAPBATCH);
+}
+
+// Fill in the swap totals of mi.
+void
+swapinfo(struct meminfo *mi)
+{
+  mi->swap = swap.nslot;
+  mi->swapfree = swap.nfree;
+}
@@ -0,0 +1,56 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+// System call latency benchmark.
+//   sysbench [n]
+// Times n (default 1000) batches of BATCH calls of a few
+// cheap system calls with the TSC, and reports the fastest
+// and the mean batch in cycles per call.
+//   getpid: trap entry and exit, myproc()
+//   gettid: the same, and the current thread
+//   uptime: a spinlock, and so mycpu() and pushcli()
+
+#define BATCH 1024
+
+static void
+bench(char *name, int (*call)(void), int n)
+{
+  uint64 t0;
+  uint c, min, sum;
+  int i, j;
+
+  min = ~0;
+  sum = 0;
+  for (i = 0; i < n; ++i)
+  {
+    t0 = rdtsc();
+    for (j = 0; j < BATCH; ++j)
+      call();
+    c = (uint)(rdtsc() - t0) / BATCH;
+    if (c < min)
+      min = c;
+    sum += c;
+  }
+  printf(1, "%s: %d cycles/call fastest, %d mean\n", name, min, sum / n);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 1000;
+
+  if (argc >= 2)
+    n = atoi(argv[1]);
+  if (n < 1)
+  {
+    printf(2, "usage: sysbench [n]\n");
+    exit();
+  }
+
+  bench("getpid", getpid, n);
+  bench("gettid", gettid, n);
+  bench("uptime", uptime, n);
+  exit();
+}
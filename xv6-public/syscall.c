@@ -13,13 +13,35 @@
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
+// Return the end of the part of the current process's
+// memory containing addr: its size if addr is below it,
+// else the end of the mapping containing addr, or 0.
+static uint
+uend(uint addr)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+  uint end;
+
+  if(addr < curproc->sz)
+    return curproc->sz;
+  end = 0;
+  lockvm(curproc);
+  if((v = findvma(curproc, addr)) != 0)
+    end = v->end;
+  unlockvm(curproc);
+  return end;
+}
+
 // Fetch the int at addr from the current process.
 int
 fetchint(uint addr, int *ip)
 {
-  struct proc *curproc = myproc();
+  uint end;
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if((end = uend(addr)) == 0 || addr+4 > end || addr+4 < addr)
+    return -1;
+  if(prefault(addr, 4) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -32,13 +54,15 @@ int
 fetchstr(uint addr, char **pp)
 {
   char *s, *ep;
-  struct proc *curproc = myproc();
+  uint end;
 
-  if(addr >= curproc->sz)
+  if((end = uend(addr)) == 0)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
+  ep = (char*)end;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && prefault((uint)s, 1) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -49,7 +73,7 @@ fetchstr(uint addr, char **pp)
 int
 argint(int n, int *ip)
 {
-  return fetchint((RTHREAD(myproc()).tf->esp) + 4 + 4*n, ip);
+  return fetchint(mythread()->tf->esp + 4 + 4*n, ip);
 }
 
 // Fetch the nth word-sized system call argument as a pointer
@@ -59,11 +83,13 @@ int
 argptr(int n, char **pp, int size)
 {
   int i;
-  struct proc *curproc = myproc();
+  uint end;
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (end = uend(i)) == 0 || (uint)i+size > end || (uint)i+size < (uint)i)
+    return -1;
+  if(prefault(i, size) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -71,8 +97,8 @@ argptr(int n, char **pp, int size)
 
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (A string in MAP_SHARED memory can still be changed by another
+// process between this check and being used by the kernel.)
 int
 argstr(int n, char **pp)
 {
@@ -116,6 +142,18 @@ extern int sys_sync(void);
 extern int sys_get_log_num(void);
 extern int sys_pwrite(void);
 extern int sys_pread(void);
+extern int sys_lockstat(void);
+extern int sys_kmemstat(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_msync(void);
+extern int sys_shm_open(void);
+extern int sys_shm_attach(void);
+extern int sys_shm_detach(void);
+extern int sys_spawn(void);
+extern int sys_meminfo(void);
+extern int sys_irqstat(void);
+extern int sys_irqaffinity(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]          sys_fork,
@@ -151,7 +189,19 @@ static int (*syscalls[])(void) = {
 [SYS_sync] sys_sync,
 [SYS_get_log_num] sys_get_log_num,
 [SYS_pwrite] sys_pwrite,
-[SYS_pread] sys_pread
+[SYS_pread] sys_pread,
+[SYS_lockstat] sys_lockstat,
+[SYS_kmemstat] sys_kmemstat,
+[SYS_mmap] sys_mmap,
+[SYS_munmap] sys_munmap,
+[SYS_msync] sys_msync,
+[SYS_shm_open] sys_shm_open,
+[SYS_shm_attach] sys_shm_attach,
+[SYS_shm_detach] sys_shm_detach,
+[SYS_spawn] sys_spawn,
+[SYS_meminfo] sys_meminfo,
+[SYS_irqstat] sys_irqstat,
+[SYS_irqaffinity] sys_irqaffinity,
 };
 
 void
@@ -159,7 +209,7 @@ syscall(void)
 {
   int num;
   struct proc *curproc = myproc();
-  struct thread *curthread = &RTHREAD(curproc);
+  struct thread *curthread = mythread();
 
   num = curthread->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
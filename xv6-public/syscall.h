@@ -33,3 +33,15 @@
 #define SYS_get_log_num 32
 #define SYS_pwrite 33
 #define SYS_pread 34
+#define SYS_lockstat 35
+#define SYS_kmemstat 36
+#define SYS_mmap 37
+#define SYS_munmap 38
+#define SYS_msync 39
+#define SYS_shm_open 40
+#define SYS_shm_attach 41
+#define SYS_shm_detach 42
+#define SYS_spawn 43
+#define SYS_meminfo 44
+#define SYS_irqstat 45
+#define SYS_irqaffinity 46
@@ -13,8 +13,12 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "mutex.h"
 #include "file.h"
 #include "fcntl.h"
+#include "memlayout.h"
+#include "mman.h"
+#include "spawn.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -257,8 +261,10 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
-    panic("create: ialloc");
+  if((ip = ialloc(dp->dev, type)) == 0){
+    iunlockput(dp);
+    return 0;
+  }
 
   ilock(ip);
   ip->major = major;
@@ -266,6 +272,16 @@ create(char *path, short type, short major, short minor)
   ip->nlink = 1;
   iupdate(ip);
 
+  // dirlookup() also fails when the inode cache is out of
+  // memory, so name may exist after all.
+  if(dirlink(dp, name, ip->inum) < 0){
+    ip->nlink = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    iunlockput(dp);
+    return 0;
+  }
+
   if(type == T_DIR){  // Create . and .. entries.
     dp->nlink++;  // for ".."
     iupdate(dp);
@@ -274,52 +290,43 @@ create(char *path, short type, short major, short minor)
       panic("create dots");
   }
 
-  if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
-
   iunlockput(dp);
 
   return ip;
 }
 
-int
-sys_open(void)
+// Open the file at path with omode (O_* flags).
+static struct file*
+openfile(char *path, int omode)
 {
-  char *path;
-  int fd, omode;
   struct file *f;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
-    return -1;
-
   begin_op();
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
       end_op();
-      return -1;
+      return 0;
     }
   } else {
     if((ip = namei(path)) == 0){
       end_op();
-      return -1;
+      return 0;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
       end_op();
-      return -1;
+      return 0;
     }
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
   iunlock(ip);
   end_op();
@@ -329,6 +336,24 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  return f;
+}
+
+int
+sys_open(void)
+{
+  char *path;
+  int fd, omode;
+  struct file *f;
+
+  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
+    return -1;
+  if((f = openfile(path, omode)) == 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -393,19 +418,20 @@ sys_chdir(void)
   return 0;
 }
 
-int
-sys_exec(void)
+// Fetch the nth system call argument as an argv array
+// of at most MAXARG strings.
+static int
+argargv(int n, char **argv)
 {
-  char *path, *argv[MAXARG];
   int i;
   uint uargv, uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+  if(argint(n, (int*)&uargv) < 0){
     return -1;
   }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= MAXARG)
       return -1;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -416,9 +442,78 @@ sys_exec(void)
     if(fetchstr(uarg, &argv[i]) < 0)
       return -1;
   }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char *path, *argv[MAXARG];
+
+  if(argstr(0, &path) < 0 || argargv(1, argv) < 0){
+    return -1;
+  }
   return exec(path, argv);
 }
 
+// Apply file action a to the open file table ofile.
+static int
+applyact(struct file **ofile, struct spawnact *a)
+{
+  struct file *f;
+  char *path;
+
+  if(a->fd < 0 || a->fd >= NOFILE)
+    return -1;
+  switch(a->type){
+  case SPAWN_CLOSE:
+    f = 0;
+    break;
+  case SPAWN_DUP:
+    if(a->src < 0 || a->src >= NOFILE || ofile[a->src] == 0)
+      return -1;
+    f = filedup(ofile[a->src]);
+    break;
+  case SPAWN_OPEN:
+    if(fetchstr((uint)a->path, &path) < 0 || (f = openfile(path, a->mode)) == 0)
+      return -1;
+    break;
+  default:
+    return -1;
+  }
+  if(ofile[a->fd])
+    fileclose(ofile[a->fd]);
+  ofile[a->fd] = f;
+  return 0;
+}
+
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG];
+  struct spawnact *act;
+  struct file *ofile[NOFILE];
+  struct proc *curproc = myproc();
+  int i, n;
+
+  if(argstr(0, &path) < 0 || argargv(1, argv) < 0 || argint(3, &n) < 0)
+    return -1;
+  if(n < 0 || n > NSPAWNACT || argptr(2, (char**)&act, n*sizeof(act[0])) < 0)
+    return -1;
+
+  for(i = 0; i < NOFILE; i++)
+    ofile[i] = curproc->ofile[i] ? filedup(curproc->ofile[i]) : 0;
+  for(i = 0; i < n; i++){
+    if(applyact(ofile, &act[i]) < 0){
+      for(i = 0; i < NOFILE; i++)
+        if(ofile[i])
+          fileclose(ofile[i]);
+      return -1;
+    }
+  }
+  return spawn(path, argv, ofile);
+}
+
 int
 sys_pipe(void)
 {
@@ -446,10 +541,79 @@ sys_pipe(void)
 int
 sys_sync(void)
 {
+  msync(MMAPBASE, KERNBASE);
   commit_sync(0);
   return 0;
 }
 
+int
+sys_mmap(void)
+{
+  struct file *f;
+  struct inode *ip;
+  int addr, len, prot, flags, off;
+  uint filesz;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || !(flags & (MAP_SHARED|MAP_PRIVATE)) ||
+     ((flags & MAP_SHARED) && (flags & MAP_PRIVATE)))
+    return -1;
+
+  ip = 0;
+  filesz = 0;
+  if(!(flags & MAP_ANONYMOUS)){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+    if(off < 0 || off % PGSIZE)
+      return -1;
+    ilock(f->ip);
+    if(f->ip->type != T_FILE){
+      iunlock(f->ip);
+      return -1;
+    }
+    if(off < f->ip->size)
+      filesz = f->ip->size - off;
+    iunlock(f->ip);
+    ip = idup(f->ip);
+  } else {
+    off = 0;
+  }
+
+  if((addr = mmap(addr, len, prot, flags, ip, off, filesz)) < 0 && ip){
+    begin_op();
+    iput(ip);
+    end_op();
+  }
+  return addr;
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+int
+sys_msync(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len < 0)
+    return -1;
+  if((uint)addr + len < (uint)addr)
+    return -1;
+  msync(addr, addr + len);
+  return 0;
+}
+
 int
 sys_get_log_num(void)
 {
@@ -6,6 +6,10 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "lockstat.h"
+#include "kmemstat.h"
+#include "meminfo.h"
+#include "irq.h"
 
 int
 sys_fork(void)
@@ -143,7 +147,7 @@ sys_gettid(void)
   if (p == 0)
     return -1;
 
-  return RTHREAD(p).tid;
+  return mythread()->tid;
 }
 
 int
@@ -192,3 +196,167 @@ sys_thread_join(void)
 
   return thread_join(thread, retval);
 }
+
+int
+sys_lockstat(void)
+{
+  int cmd, n;
+  struct lockstat *buf;
+
+  if (argint(0, &cmd) < 0 || argint(2, &n) < 0)
+    return -1;
+
+  if (cmd == LOCKSTAT_RESET)
+    return lockstat_reset();
+
+  if (cmd != LOCKSTAT_DUMP || n < 0)
+    return -1;
+  if (n > NLOCKSTAT)
+    n = NLOCKSTAT;
+  if (argptr(1, (char **)&buf, n * sizeof(*buf)) < 0)
+    return -1;
+
+  return lockstat_dump(buf, n);
+}
+
+int
+sys_kmemstat(void)
+{
+  int cmd, n;
+  struct kcachestat *buf;
+  struct buddystat *bs;
+  struct slabstat *ss;
+  struct superstat *sup;
+  struct bcachestat *bc;
+
+  if (argint(0, &cmd) < 0 || argint(2, &n) < 0)
+    return -1;
+
+  if (cmd == KMEMSTAT_BUDDY)
+  {
+    if (argptr(1, (char **)&bs, sizeof(*bs)) < 0)
+      return -1;
+    kbuddystat(bs);
+    return 0;
+  }
+
+  if (cmd == KMEMSTAT_BCACHE)
+  {
+    if (argptr(1, (char **)&bc, sizeof(*bc)) < 0)
+      return -1;
+    bcachestat(bc);
+    return 0;
+  }
+
+  if (cmd == KMEMSTAT_SUPER)
+  {
+    if (n < 0)
+      return -1;
+    if (n > NPROC)
+      n = NPROC;
+    if (argptr(1, (char **)&sup, n * sizeof(*sup)) < 0)
+      return -1;
+    return procsuperstat(sup, n);
+  }
+
+  if (cmd == KMEMSTAT_SLAB)
+  {
+    if (n < 0)
+      return -1;
+    if (n > KMEM_NCACHE)
+      n = KMEM_NCACHE;
+    if (argptr(1, (char **)&ss, n * sizeof(*ss)) < 0)
+      return -1;
+    return kslabstat(ss, n);
+  }
+
+  if (cmd != KMEMSTAT_CPU || n < 0)
+    return -1;
+  if (n > ncpu)
+    n = ncpu;
+  if (argptr(1, (char **)&buf, n * sizeof(*buf)) < 0)
+    return -1;
+
+  return kcachestat(buf, n);
+}
+
+int
+sys_shm_open(void)
+{
+  char *name;
+  int size;
+  struct shm *s;
+
+  if (argstr(0, &name) < 0 || argint(1, &size) < 0 || size <= 0)
+    return -1;
+  if ((s = shmopen(name, size)) == 0)
+    return -1;
+  return shmid(s);
+}
+
+int
+sys_shm_attach(void)
+{
+  int id, addr;
+  struct shm *s;
+
+  if (argint(0, &id) < 0 || argint(1, &addr) < 0)
+    return -1;
+  if ((s = shmget(id)) == 0)
+    return -1;
+  if ((addr = shmattach(s, addr)) < 0)
+    shmput(s);
+  return addr;
+}
+
+int
+sys_shm_detach(void)
+{
+  int addr;
+
+  if (argint(0, &addr) < 0)
+    return -1;
+  return shmdetach(addr);
+}
+
+int
+sys_meminfo(void)
+{
+  struct meminfo *mi;
+  struct procmem *pm;
+  int n;
+
+  if (argint(2, &n) < 0 || n < 0)
+    return -1;
+  if (n > NPROC)
+    n = NPROC;
+  if (argptr(0, (char **)&mi, sizeof(*mi)) < 0 ||
+      argptr(1, (char **)&pm, n * sizeof(*pm)) < 0)
+    return -1;
+  return procmeminfo(mi, pm, n);
+}
+
+int
+sys_irqstat(void)
+{
+  struct irqstat *st;
+  int n;
+
+  if (argint(1, &n) < 0 || n < 0)
+    return -1;
+  if (n > NIRQ)
+    n = NIRQ;
+  if (argptr(0, (char **)&st, n * sizeof(*st)) < 0)
+    return -1;
+  return irqstat(st, n);
+}
+
+int
+sys_irqaffinity(void)
+{
+  int irq, cpu;
+
+  if (argint(0, &irq) < 0 || argint(1, &cpu) < 0)
+    return -1;
+  return ioapicroute(irq, cpu);
+}
@@ -0,0 +1,148 @@
+// TLB shootdown.
+//
+// The threads of a process may run on several CPUs at once,
+// each caching translations of the process's page table in
+// its TLB. p->cpumask has a bit for each CPU that may hold
+// such translations: switchuvm() sets it before loading
+// p->pgdir, and the scheduler clears it after switching
+// back to kpgdir, which flushes them.
+//
+// After changing or removing PTEs of p, the kernel calls
+// tlbshoot(), which flushes the range on this CPU and sends
+// the other CPUs in the mask an IPI to do the same, waiting
+// until all have. One shootdown covers a whole range, so
+// unmapping many pages costs one round of IPIs, not one per
+// page. A process running on one CPU sends none.
+//
+// The sender waits with interrupts off, and so may a target,
+// spinning for a lock the sender holds. So the spinlock
+// loops, and a sender waiting for its turn, call tlbpoll()
+// to do any shootdown waiting for this CPU.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+
+#define TLBFULL  32  // pages above which to flush the whole TLB
+
+// The shootdown in progress. One at a time.
+static struct {
+  volatile uint busy;
+  pde_t *pgdir;
+  uint start, end;
+  volatile uint pending;   // Targets yet to flush
+} shoot;
+
+static void
+setbit(volatile uint *a, int n)
+{
+  asm volatile("lock; btsl %1, %0" : "+m" (*a) : "r" (n) : "memory");
+}
+
+static void
+clrbit(volatile uint *a, int n)
+{
+  asm volatile("lock; btrl %1, %0" : "+m" (*a) : "r" (n) : "memory");
+}
+
+static int
+hasbit(volatile uint *a, int n)
+{
+  return (a[n / 32] >> (n % 32)) & 1;
+}
+
+// Flush [start, end) of the current page table on this CPU.
+static void
+tlbflush(uint start, uint end)
+{
+  uint a;
+
+  if((end - start) / PGSIZE > TLBFULL){
+    lcr3(rcr3());
+    return;
+  }
+  for(a = PGROUNDDOWN(start); a < end; a += PGSIZE)
+    invlpg((char*)a);
+}
+
+// This CPU is about to load p->pgdir.
+// Caller must have interrupts disabled.
+void
+tlbjoin(struct proc *p)
+{
+  setbit(p->cpumask, cpuid());
+}
+
+// This CPU has switched away from p->pgdir.
+void
+tlbleave(struct proc *p)
+{
+  clrbit(p->cpumask, cpuid());
+}
+
+// Do the shootdown waiting for this CPU, if any.
+// Called with interrupts off: from the IPI, and while
+// spinning.
+void
+tlbpoll(void)
+{
+  struct cpu *c;
+
+  c = mycpu();
+  if(!c->tlbwork)
+    return;
+  c->tlbwork = 0;
+  // A CPU that has switched page tables since has
+  // nothing left to flush.
+  if(rcr3() == V2P(shoot.pgdir))
+    tlbflush(shoot.start, shoot.end);
+  xadd(&shoot.pending, -1);
+}
+
+// Flush [start, end) of p's address space from the TLB of
+// every CPU that may hold it, and wait until they have.
+void
+tlbshoot(struct proc *p, uint start, uint end)
+{
+  struct cpu *c, *me, *target[NCPU];
+  int i, n;
+
+  pushcli();
+  me = mycpu();
+  if(rcr3() == V2P(p->pgdir))
+    tlbflush(start, end);
+
+  // The PTE stores must be visible before the mask is read,
+  // or a CPU joining now could miss them.
+  __sync_synchronize();
+  n = 0;
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c != me && hasbit(p->cpumask, c - cpus))
+      target[n++] = c;
+  if(n == 0){
+    popcli();
+    return;
+  }
+
+  while(xchg(&shoot.busy, 1) != 0){
+    tlbpoll();
+    pause();
+  }
+  shoot.pgdir = p->pgdir;
+  shoot.start = start;
+  shoot.end = end;
+  shoot.pending = n;
+  for(i = 0; i < n; i++){
+    target[i]->tlbwork = 1;
+    lapicipi(target[i]->apicid, T_TLBSHOOT);
+  }
+  while(shoot.pending != 0)
+    pause();
+  xchg(&shoot.busy, 0);
+  popcli();
+}
@@ -7,6 +7,7 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "irq.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
@@ -39,13 +40,20 @@ trap(struct trapframe *tf)
   if(tf->trapno == T_SYSCALL){
     if(myproc()->killed)
       exit();
-    RTHREAD(myproc()).tf = tf;
+    mythread()->tf = tf;
+    mythread()->insyscall = 1;
     syscall();
+    mythread()->insyscall = 0;
     if(myproc()->killed)
       exit();
     return;
   }
 
+  // Interrupts are off in here, so the counters of this
+  // CPU need no lock.
+  if(tf->trapno >= T_IRQ0 && tf->trapno < T_IRQ0 + NIRQ)
+    mycpu()->nintr[tf->trapno - T_IRQ0]++;
+
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
     if(cpuid() == 0){
@@ -71,12 +79,29 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_TLBSHOOT:
+    tlbpoll();
+    lapiceoi();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
             cpuid(), tf->cs, tf->eip);
     lapiceoi();
     break;
+  case T_PGFLT:
+    if(myproc() != 0 && pagefault(rcr2(), tf->err) == 0)
+      break;
+    // A bad user address in a system call, which prefault()
+    // checked, kills the process, not the kernel.
+    if(myproc() != 0 && (tf->cs&3) == 0 && killfault(rcr2()) == 0){
+      cprintf("pid %d tid %d %s: bad address 0x%x in system call "
+              "on cpu %d--kill proc\n",
+              myproc()->pid, mythread()->tid, myproc()->name, rcr2(),
+              cpuid());
+      break;
+    }
+    // Not a fault we can resolve: fall through.
 
   //PAGEBREAK: 13
   default:
@@ -89,7 +114,7 @@ trap(struct trapframe *tf)
     // In user space, assume process misbehaved.
     cprintf("pid %d tid %d %s: trap %d err %d on cpu %d "
             "eip 0x%x addr 0x%x--kill proc\n",
-            myproc()->pid, RTHREAD(myproc()).tid, myproc()->name, tf->trapno,
+            myproc()->pid, mythread()->tid, myproc()->name, tf->trapno,
             tf->err, cpuid(), tf->eip, rcr2());
     myproc()->killed = 1;
   }
@@ -102,7 +127,7 @@ trap(struct trapframe *tf)
 
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
-  if(myproc() && RTHREAD(myproc()).state == RUNNING &&
+  if(myproc() && mythread()->state == RUNNING &&
      tf->trapno == T_IRQ0+IRQ_TIMER)
     yield();
 
@@ -110,3 +135,18 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 }
+
+// Copy the routing and per-CPU counters of the first n IRQs
+// to st. Returns the number of CPUs.
+int
+irqstat(struct irqstat *st, int n)
+{
+  int i, c;
+
+  for(i = 0; i < n && i < NIRQ; i++){
+    st[i].cpu = ioapiccpu(i);
+    for(c = 0; c < NCPU; c++)
+      st[i].count[c] = c < ncpu ? cpus[c].nintr[i] : 0;
+  }
+  return ncpu;
+}
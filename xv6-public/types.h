@@ -2,4 +2,5 @@ typedef unsigned int   uint;
 typedef unsigned short ushort;
 typedef unsigned char  uchar;
 typedef uint pde_t;
-typedef int thread_t;
\ No newline at end of file
+typedef int thread_t;
+typedef unsigned long long uint64;
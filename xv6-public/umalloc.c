@@ -2,31 +2,234 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "mmu.h"
+#include "mman.h"
+#include "x86.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator for user programs, safe to call from
+// several threads.
+//
+// Small blocks (up to 2KB with the header) come in size
+// classes. Each thread keeps free lists of them, so most
+// calls take no lock; a list that runs empty takes a
+// batch from the class's central list, and one grown too
+// long gives a batch back. Central lists are carved from
+// sbrk() memory a chunk at a time.
+//
+// A thread is known by its user stack, one page per
+// thread, so that finding its cache costs no system call.
+// A stack page reused by a later thread hands it the
+// cache of the thread that had it.
+//
+// Blocks of LARGE bytes or more are mmap()ed, and unmapped
+// again when freed. The rest come from the first-fit heap
+// by Kernighan and Ritchie, The C programming Language,
+// 2nd ed.  Section 8.7, under one lock.
 
 typedef long Align;
 
 union header {
   struct {
-    union header *ptr;
-    uint size;
+    union header *ptr;   // Next free block
+    uint size;           // In units of Header; see below
   } s;
   Align x;
 };
 
 typedef union header Header;
 
+// The size of an allocated small block is SMALL with its
+// class, of an mmap()ed one MAPPED with its pages.
+#define SMALL    0x80000000
+#define MAPPED   0x40000000
+
+#define NCLASS   8          // classes of 16 to 2048 bytes
+#define CLASS0   16
+#define CHUNK    (4*PGSIZE) // carved into blocks of a class
+#define NTCACHE  64         // thread caches
+#define LARGE    (64*1024)
+
+struct tcache {
+  volatile uint owner;      // Stack page of the thread, or 0
+  Header *free[NCLASS];
+  uint nfree[NCLASS];
+};
+
+struct central {
+  volatile uint lock;
+  Header *free;
+  uint nfree;
+};
+
+static struct tcache tcache[NTCACHE];
+static struct central central[NCLASS];
+
 static Header base;
 static Header *freep;
+static volatile uint heaplock;
 
-void
-free(void *ap)
+static void
+lock(volatile uint *l)
 {
-  Header *bp, *p;
+  int i;
+
+  for(i = 0; xchg(l, 1) != 0; i++){
+    if(i < 100)
+      pause();
+    else
+      yield();  // the holder may not be running
+  }
+}
+
+static void
+unlock(volatile uint *l)
+{
+  xchg(l, 0);
+}
+
+// Blocks of class c hold CLASS0 << c bytes, header included.
+static int
+sizeclass(uint nbytes)
+{
+  int c;
+
+  if(nbytes > (CLASS0 << (NCLASS-1)) - sizeof(Header))
+    return -1;
+  for(c = 0; nbytes + sizeof(Header) > (CLASS0 << c); c++)
+    ;
+  return c;
+}
+
+// Blocks moved between a thread cache and central at once.
+static uint
+batch(int c)
+{
+  uint n;
+
+  n = PGSIZE / (CLASS0 << c);
+  return n < 4 ? 4 : n;
+}
+
+// Return the cache of the calling thread, or 0 if all
+// are taken.
+static struct tcache*
+mycache(void)
+{
+  struct tcache *tc;
+  uint key, i;
+
+  key = (uint)&key / PGSIZE;
+  for(i = 0; i < NTCACHE; i++){
+    tc = &tcache[(key + i) % NTCACHE];
+    if(tc->owner == key)
+      return tc;
+    if(tc->owner == 0 && cmpxchg(&tc->owner, 0, key) == 0)
+      return tc;
+  }
+  return 0;
+}
+
+// Move up to n blocks of class c from central to *list,
+// carving a new chunk if central has none.
+// Returns the number moved. Caller holds the class lock.
+static uint
+takebatch(int c, Header **list, uint n)
+{
+  struct central *ct;
+  Header *hp;
+  char *p;
+  uint i, sz;
+
+  ct = &central[c];
+  if(ct->free == 0){
+    sz = CLASS0 << c;
+    if((p = sbrk(CHUNK)) == (char*)-1)
+      return 0;
+    for(i = 0; i + sz <= CHUNK; i += sz){
+      hp = (Header*)(p + i);
+      hp->s.ptr = ct->free;
+      ct->free = hp;
+      ct->nfree++;
+    }
+  }
+  for(i = 0; i < n && ct->free; i++){
+    hp = ct->free;
+    ct->free = hp->s.ptr;
+    ct->nfree--;
+    hp->s.ptr = *list;
+    *list = hp;
+  }
+  return i;
+}
+
+static void*
+smallalloc(int c)
+{
+  struct tcache *tc;
+  Header *hp;
+
+  hp = 0;
+  if((tc = mycache()) == 0){
+    lock(&central[c].lock);
+    takebatch(c, &hp, 1);
+    unlock(&central[c].lock);
+  } else {
+    if(tc->free[c] == 0){
+      lock(&central[c].lock);
+      tc->nfree[c] += takebatch(c, &tc->free[c], batch(c));
+      unlock(&central[c].lock);
+    }
+    if((hp = tc->free[c]) != 0){
+      tc->free[c] = hp->s.ptr;
+      tc->nfree[c]--;
+    }
+  }
+  if(hp == 0)
+    return 0;
+  hp->s.size = SMALL | c;
+  return (void*)(hp + 1);
+}
+
+static void
+smallfree(Header *bp, int c)
+{
+  struct tcache *tc;
+  struct central *ct;
+  Header *hp;
+  uint n;
+
+  ct = &central[c];
+  if((tc = mycache()) == 0){
+    lock(&ct->lock);
+    bp->s.ptr = ct->free;
+    ct->free = bp;
+    ct->nfree++;
+    unlock(&ct->lock);
+    return;
+  }
+
+  bp->s.ptr = tc->free[c];
+  tc->free[c] = bp;
+  if(++tc->nfree[c] < 2*batch(c))
+    return;
+  lock(&ct->lock);
+  for(n = batch(c); n > 0; n--){
+    hp = tc->free[c];
+    tc->free[c] = hp->s.ptr;
+    hp->s.ptr = ct->free;
+    ct->free = hp;
+  }
+  tc->nfree[c] -= batch(c);
+  ct->nfree += batch(c);
+  unlock(&ct->lock);
+}
+
+// Put bp on the first-fit heap. Caller holds heaplock.
+static void
+heapfree(Header *bp)
+{
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -56,17 +259,18 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  heapfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+static void*
+heapalloc(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
 
   nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  lock(&heaplock);
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -81,10 +285,53 @@ malloc(uint nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
+      unlock(&heaplock);
       return (void*)(p + 1);
     }
     if(p == freep)
-      if((p = morecore(nunits)) == 0)
+      if((p = morecore(nunits)) == 0){
+        unlock(&heaplock);
         return 0;
+      }
+  }
+}
+
+void
+free(void *ap)
+{
+  Header *bp;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  if(bp->s.size & SMALL)
+    smallfree(bp, bp->s.size & ~SMALL);
+  else if(bp->s.size & MAPPED)
+    munmap(bp, (bp->s.size & ~MAPPED) * PGSIZE);
+  else {
+    lock(&heaplock);
+    heapfree(bp);
+    unlock(&heaplock);
+  }
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *hp;
+  uint sz;
+  int c;
+
+  if((c = sizeclass(nbytes)) >= 0)
+    return smallalloc(c);
+  if(nbytes >= LARGE && nbytes < MAPPED){
+    sz = PGROUNDUP(nbytes + sizeof(Header));
+    hp = mmap(0, sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(hp != MAP_FAILED){
+      hp->s.size = MAPPED | (sz / PGSIZE);
+      return (void*)(hp + 1);
+    }
+    // Out of mappings: use the heap.
   }
+  return heapalloc(nbytes);
 }
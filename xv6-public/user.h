@@ -1,5 +1,10 @@
 struct stat;
 struct rtcdate;
+struct lockstat;
+struct spawnact;
+struct meminfo;
+struct irqstat;
+struct procmem;
 
 // system calls
 int fork(void);
@@ -36,6 +41,18 @@ int sync(void);
 int get_log_num(void);
 int pwrite(int fd, void* addr, int n, int off);
 int pread(int fd, void* addr, int n, int off);
+int lockstat(int cmd, struct lockstat *buf, int n);
+int kmemstat(int cmd, void *buf, int n);
+void* mmap(void *addr, int len, int prot, int flags, int fd, int off);
+int munmap(void *addr, int len);
+int msync(void *addr, int len);
+int shm_open(char *name, int size);
+void* shm_attach(int id, void *addr);
+int shm_detach(void *addr);
+int spawn(char *path, char **argv, struct spawnact *act, int nact);
+int meminfo(struct meminfo *mi, struct procmem *pm, int n);
+int irqstat(struct irqstat *st, int n);
+int irqaffinity(int irq, int cpu);
 
 // ulib.c
 int stat(const char *, struct stat *);
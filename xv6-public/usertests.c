@@ -7,6 +7,8 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "mman.h"
+#include "meminfo.h"
 
 char buf[8192];
 char name[3];
@@ -1411,6 +1413,314 @@ forktest(void)
   printf(1, "fork test OK\n");
 }
 
+// Do the pages a fork child shares copy-on-write with its
+// parent stay apart when either of them writes?
+void
+cowtest(void)
+{
+  char *p, c;
+  int i, pid, go[2], res[2];
+
+  printf(stdout, "cow test\n");
+#define COWSZ (8*4096)
+  p = sbrk(COWSZ);
+  for(i = 0; i < COWSZ; i++)
+    p[i] = i % 251;
+  if(pipe(go) < 0 || pipe(res) < 0){
+    printf(stdout, "cow test pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "cow test fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    // Write the even bytes, then wait for the parent to
+    // write the odd ones, which must not show up here.
+    for(i = 0; i < COWSZ; i += 2)
+      p[i] = 7;
+    read(go[0], &c, 1);
+    c = 'y';
+    for(i = 0; i < COWSZ; i++)
+      if(p[i] != (i % 2 ? (char)(i % 251) : 7))
+        c = 'n';
+    write(res[1], &c, 1);
+    exit();
+  }
+  for(i = 1; i < COWSZ; i += 2)
+    p[i] = 9;
+  write(go[1], "x", 1);
+  if(read(res[0], &c, 1) != 1 || c != 'y'){
+    printf(stdout, "cow test: parent's writes reached the child\n");
+    exit();
+  }
+  wait();
+  for(i = 0; i < COWSZ; i++){
+    if(p[i] != (i % 2 ? 9 : (char)(i % 251))){
+      printf(stdout, "cow test: child's writes reached the parent\n");
+      exit();
+    }
+  }
+  close(go[0]);
+  close(go[1]);
+  close(res[0]);
+  close(res[1]);
+  sbrk(-COWSZ);
+  printf(stdout, "cow test ok\n");
+}
+
+// Do writes through MAP_SHARED reach the file, on msync()
+// and on munmap(), and do MAP_PRIVATE ones stay out of it?
+// A read() into a read-only mapping must kill the process
+// and leave the file alone.
+void
+mmaptest(void)
+{
+  char *p;
+  int fd, i, pid;
+
+  printf(stdout, "mmap test\n");
+#define MMAPSZ (2*4096)
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  for(i = 0; i < MMAPSZ; i++)
+    buf[i] = i % 199;
+  if(fd < 0 || write(fd, buf, MMAPSZ) != MMAPSZ){
+    printf(stdout, "mmap test: cannot create mmapfile\n");
+    exit();
+  }
+
+  p = mmap(0, MMAPSZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap test: MAP_SHARED mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < MMAPSZ; i++){
+    if(p[i] != buf[i]){
+      printf(stdout, "mmap test: mapping differs from file at %d\n", i);
+      exit();
+    }
+  }
+  p[0] = 'a';
+  if(msync(p, MMAPSZ) < 0 || pread(fd, buf, 1, 0) != 1 || buf[0] != 'a'){
+    printf(stdout, "mmap test: msync did not write the file\n");
+    exit();
+  }
+  p[MMAPSZ-1] = 'b';
+  if(munmap(p, MMAPSZ) < 0 || pread(fd, buf, MMAPSZ, 0) != MMAPSZ ||
+     buf[MMAPSZ-1] != 'b'){
+    printf(stdout, "mmap test: munmap did not write the file\n");
+    exit();
+  }
+
+  p = mmap(0, MMAPSZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap test: MAP_PRIVATE mmap failed\n");
+    exit();
+  }
+  p[1] = 'c';
+  if(p[0] != 'a' || p[1] != 'c' || munmap(p, MMAPSZ) < 0){
+    printf(stdout, "mmap test: MAP_PRIVATE mapping is wrong\n");
+    exit();
+  }
+  close(fd);
+
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "mmap test: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    fd = open("mmapfile", O_RDONLY);
+    p = mmap(0, MMAPSZ, PROT_READ, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED){
+      printf(stdout, "mmap test: read-only mmap failed\n");
+      exit();
+    }
+    fd = open("init", O_RDONLY);
+    read(fd, p, 512);
+    printf(stdout, "mmap test: read into read-only mapping worked\n");
+    exit();
+  }
+  wait();
+
+  fd = open("mmapfile", O_RDONLY);
+  if(fd < 0 || read(fd, buf, MMAPSZ) != MMAPSZ){
+    printf(stdout, "mmap test: cannot read mmapfile\n");
+    exit();
+  }
+  for(i = 0; i < MMAPSZ; i++){
+    if(buf[i] != (i == 0 ? 'a' : i == MMAPSZ-1 ? 'b' : (char)(i % 199))){
+      printf(stdout, "mmap test: file is wrong at %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  unlink("mmapfile");
+  printf(stdout, "mmap test ok\n");
+}
+
+// Do a parent and child see each other's writes through a
+// shared memory segment, and does its id stop working once
+// the last attachment is gone?
+void
+shmtest(void)
+{
+  char *p, c;
+  int id, pid, go[2], res[2];
+
+  printf(stdout, "shm test\n");
+  if(shm_open("usertests-shm-name", 4096) >= 0){
+    printf(stdout, "shm test: name of 18 characters accepted\n");
+    exit();
+  }
+  if((id = shm_open("utshm", 2*4096)) < 0){
+    printf(stdout, "shm test: shm_open failed\n");
+    exit();
+  }
+  if(shm_open("utshm", 4096) != id){
+    printf(stdout, "shm test: shm_open of the same name gave another id\n");
+    exit();
+  }
+  p = shm_attach(id, 0);
+  if(p == (char*)-1){
+    printf(stdout, "shm test: shm_attach failed\n");
+    exit();
+  }
+  if(pipe(go) < 0 || pipe(res) < 0){
+    printf(stdout, "shm test: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "shm test: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    p[0] = 'c';
+    p[4096] = 'd';
+    write(res[1], "x", 1);
+    read(go[0], &c, 1);
+    c = p[1] == 'p' ? 'y' : 'n';
+    write(res[1], &c, 1);
+    exit();
+  }
+  read(res[0], &c, 1);
+  if(p[0] != 'c' || p[4096] != 'd'){
+    printf(stdout, "shm test: child's writes did not reach the parent\n");
+    exit();
+  }
+  p[1] = 'p';
+  write(go[1], "x", 1);
+  if(read(res[0], &c, 1) != 1 || c != 'y'){
+    printf(stdout, "shm test: parent's writes did not reach the child\n");
+    exit();
+  }
+  wait();
+  close(go[0]);
+  close(go[1]);
+  close(res[0]);
+  close(res[1]);
+
+  if(shm_detach(p) < 0){
+    printf(stdout, "shm test: shm_detach failed\n");
+    exit();
+  }
+  if(shm_detach(p) >= 0 || shm_attach(id, 0) != (char*)-1){
+    printf(stdout, "shm test: segment still there after detach\n");
+    exit();
+  }
+  printf(stdout, "shm test ok\n");
+}
+
+struct meminfo mi;
+struct procmem pm[NPROC];
+
+// Pages written to swap and back of this process, from meminfo.
+// Returns -1 if it cannot be found.
+static int
+swapcount(uint *in, uint *out)
+{
+  int i, n, pid;
+
+  pid = getpid();
+  if((n = meminfo(&mi, pm, NPROC)) < 0)
+    return -1;
+  for(i = 0; i < n; i++){
+    if(pm[i].pid == pid){
+      *in = pm[i].swapin;
+      *out = pm[i].swapout;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Grow a child's heap a page at a time, so no 4MB pages are
+// used, until some of it has been written to swap, then check
+// every page comes back with what was written to it.
+void
+swaptest(void)
+{
+  char *base, *p, c;
+  uint i, n, in, out;
+  int fds[2];
+
+  printf(stdout, "swap test\n");
+  if(pipe(fds) < 0){
+    printf(stdout, "swap test: pipe failed\n");
+    exit();
+  }
+  if(fork() == 0){
+    c = 'n';
+    out = 0;
+    base = sbrk(0);
+    for(n = 0; ; n++){
+      if(n % 256 == 0){
+        if(swapcount(&in, &out) < 0){
+          printf(stdout, "swap test: meminfo failed\n");
+          break;
+        }
+        if(out >= 64)
+          break;
+        if(n >= mi.total){
+          printf(stdout, "swap test: nothing swapped out\n");
+          break;
+        }
+      }
+      if((p = sbrk(4096)) == (char*)-1){
+        printf(stdout, "swap test: sbrk failed after %d pages\n", n);
+        break;
+      }
+      ((uint*)p)[0] = n;
+      ((uint*)p)[4096/sizeof(uint) - 1] = ~n;
+    }
+    if(out >= 64){
+      for(i = 0; i < n; i++){
+        p = base + i*4096;
+        if(((uint*)p)[0] != i || ((uint*)p)[4096/sizeof(uint) - 1] != ~i){
+          printf(stdout, "swap test: page %d lost its contents\n", i);
+          break;
+        }
+      }
+      if(i == n && swapcount(&in, &out) == 0 && in > 0)
+        c = 'y';
+      else if(i == n)
+        printf(stdout, "swap test: nothing swapped back in\n");
+    }
+    write(fds[1], &c, 1);
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 1 || c != 'y'){
+    printf(stdout, "swap test failed\n");
+    exit();
+  }
+  close(fds[0]);
+  wait();
+  printf(stdout, "swap test ok\n");
+}
+
 void
 sbrktest(void)
 {
@@ -1793,6 +2103,10 @@ main(int argc, char *argv[])
   dirfile();
   iref();
   forktest();
+  cowtest();
+  mmaptest();
+  shmtest();
+  swaptest(); // slow
   bigdir(); // slow
 
   uio();
@@ -6,6 +6,14 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "mman.h"
+#include "meminfo.h"
+
+#define SUPERORDER  10  // buddy order of a 4MB page
+#define SWAPSCAN    1024  // PTEs uvmevict() looks at per call
+#define NGATHER     32    // pages unmapped per TLB shootdown
+
+#define SWAPSLOT(pte)  ((uint)(pte) >> PTXSHIFT)
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -16,22 +24,41 @@ void
 seginit(void)
 {
   struct cpu *c;
+  int apicid;
+
+  // mycpu() doesn't work until %gs is loaded below, so
+  // find this CPU by its APIC ID.
+  apicid = lapicid();
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c->apicid == apicid)
+      break;
+  if(c == cpus+ncpu)
+    panic("seginit: unknown apicid");
 
   // Map "logical" addresses to virtual addresses using identity map.
   // Cannot share a CODE descriptor for both kernel and user
   // because it would have to have DPL_USR, but the CPU forbids
   // an interrupt from CPL=0 to DPL=3.
-  c = &cpus[cpuid()];
   c->gdt[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, 0);
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+
+  // Map cpu-local storage at %gs: the cpu, proc and thread
+  // fields of c.
+  c->gdt[SEG_KCPU] = SEG(STA_W, &c->cpu, 12, 0);
   lgdt(c->gdt, sizeof(c->gdt));
+  loadgs(SEG_KCPU << 3);
+  c->cpu = c;
+  c->proc = 0;
+  c->thread = 0;
 }
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages. If va lies in a
+// 4MB page, return its PTE_PS directory entry, which has
+// the same flag bits as a PTE.
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -39,13 +66,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return pde;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -85,6 +113,12 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // page protection bits prevent user code from using the kernel's
 // mappings.
 //
+// kvmalloc() builds the kernel half once, in kpgdir, and
+// setupkvm() shares it by reference: a new page directory
+// gets copies of kpgdir's kernel PDEs, pointing at the same
+// page table pages and 4MB pages. freevm() only frees the
+// user half.
+//
 // setupkvm() and exec() set up every page table like this:
 //
 //   0..KERNBASE: user memory (text+data+stack+heap), mapped to
@@ -114,33 +148,88 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+// Like mappages(), but map whole aligned 4MB pieces of
+// the range with one PTE_PS directory entry each.
+static int
+kmappages(pde_t *pgdir, char *va, uint size, uint pa, int perm)
+{
+  uint n;
+
+  while(size > 0){
+    if((uint)va % PDSIZE == 0 && pa % PDSIZE == 0 && size >= PDSIZE){
+      if(pgdir[PDX(va)] & PTE_P)
+        panic("kmappages: remap");
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS;
+      n = PDSIZE;
+    } else {
+      // 4KB pages up to the next 4MB boundary.
+      n = PDSIZE - (uint)va % PDSIZE;
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, va, n, pa, perm) < 0)
+        return -1;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
+// Set up kernel part of a page table, sharing kpgdir's.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kzalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes. Its kernel half is shared by
+// every process's page table.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  if((kpgdir = (pde_t*)kzalloc()) == 0)
+    panic("kvmalloc");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(kmappages(kpgdir, k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
+  switchkvm();
+}
+
+// Map the 8MB of physical memory from pa's 4MB page at
+// FWWINDOW, so that the kernel can read firmware tables
+// that lie above PHYSTOP, and return the address of pa
+// there. Only for use in kpgdir at boot, before the other
+// CPUs and any process exist; kunmapfw() removes it.
+char*
+kmapfw(uint pa)
+{
+  uint base;
+
+  base = pa & ~(PDSIZE-1);
+  kpgdir[PDX(FWWINDOW)] = base | PTE_P | PTE_PS;
+  kpgdir[PDX(FWWINDOW)+1] = (base + PDSIZE) | PTE_P | PTE_PS;
+  switchkvm();
+  return (char*)FWWINDOW + (pa - base);
+}
+
+void
+kunmapfw(void)
+{
+  kpgdir[PDX(FWWINDOW)] = 0;
+  kpgdir[PDX(FWWINDOW)+1] = 0;
   switchkvm();
 }
 
@@ -158,7 +247,7 @@ switchuvm(struct proc *p)
 {
   if(p == 0)
     panic("switchuvm: no process");
-  if(RTHREAD(p).kstack == 0)
+  if(mythread() == 0 || mythread()->kstack == 0)
     panic("switchuvm: no kstack");
   if(p->pgdir == 0)
     panic("switchuvm: no pgdir");
@@ -168,11 +257,12 @@ switchuvm(struct proc *p)
                                 sizeof(mycpu()->ts)-1, 0);
   mycpu()->gdt[SEG_TSS].s = 0;
   mycpu()->ts.ss0 = SEG_KDATA << 3;
-  mycpu()->ts.esp0 = (uint)RTHREAD(p).kstack + KSTACKSIZE;
+  mycpu()->ts.esp0 = (uint)mythread()->kstack + KSTACKSIZE;
   // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
+  tlbjoin(p);
   lcr3(V2P(p->pgdir));  // switch to process's address space
   popcli();
 }
@@ -186,36 +276,11 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
-  return 0;
-}
-
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -231,13 +296,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -248,21 +312,103 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
-// Deallocate user pages to bring the process size from oldsz to
-// newsz.  oldsz and newsz need not be page-aligned, nor does newsz
-// need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// Split the 4MB page around va in pgdir into 4KB pages,
+// which can then be freed or shared one at a time.
+static int
+demote(pde_t *pgdir, uint va)
+{
+  struct proc *p;
+  pde_t *pde;
+  pte_t *pgtab;
+  uint pa, flags, i;
+
+  pde = &pgdir[PDX(va)];
+  if((pgtab = (pte_t*)kalloc()) == 0)
+    return -1;
+  pa = PTE_ADDR(*pde);
+  flags = PTE_FLAGS(*pde) & ~PTE_PS;
+  ksplit(P2V(pa), SUPERORDER);
+  for(i = 0; i < NPTENTRIES; i++)
+    pgtab[i] = (pa + i*PGSIZE) | flags;
+  *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+
+  if((p = myproc()) != 0 && p->pgdir == pgdir)
+    p->nsdemote++;
+  return 0;
+}
+
+// Split the 4MB pages that [start, end) covers only in
+// part, so that the range can be unmapped. Returns -1
+// if out of memory.
 int
-deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+splitsuper(pde_t *pgdir, uint start, uint end)
 {
-  pte_t *pte;
-  uint a, pa;
+  if(start % PDSIZE && (pgdir[PDX(start)] & PTE_PS) &&
+     demote(pgdir, start) < 0)
+    return -1;
+  if(end % PDSIZE && end < KERNBASE && (pgdir[PDX(end)] & PTE_PS) &&
+     demote(pgdir, end) < 0)
+    return -1;
+  return 0;
+}
 
-  if(newsz >= oldsz)
-    return oldsz;
+// Pages unmapped but not yet freed, waiting for the TLBs
+// to drop them.
+struct gather {
+  char *v[NGATHER];
+  uchar super[NGATHER];  // Is v[i] a 4MB page?
+  int n;
+};
+
+// Flush [start, end) of p's address space from every TLB,
+// if p is not 0, then free the pages gathered from it.
+static void
+freegather(struct proc *p, uint start, uint end, struct gather *g)
+{
+  int i;
+
+  if(p && g->n > 0)
+    tlbshoot(p, start, end);
+  for(i = 0; i < g->n; i++){
+    if(g->super[i])
+      kfree_pages(g->v[i], SUPERORDER);
+    else
+      kfree(g->v[i]);
+  }
+  g->n = 0;
+}
+
+// Unmap and free the user pages of pgdir in [newsz, oldsz).
+// If p is not 0, pgdir is p's, which other CPUs may be
+// using, so pages are freed only once they are flushed
+// from every TLB, NGATHER at a time.
+static void
+unmaprange(struct proc *p, pde_t *pgdir, uint oldsz, uint newsz)
+{
+  struct gather g;
+  pte_t *pte;
+  uint a, start, pa;
 
-  a = PGROUNDUP(newsz);
+  g.n = 0;
+  start = a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    if(g.n == NGATHER){
+      freegather(p, start, a, &g);
+      start = a;
+    }
+    if(pgdir[PDX(a)] & PTE_PS){
+      // Free a whole 4MB page; split one freed in part.
+      if(a % PDSIZE == 0 && a + PDSIZE <= oldsz){
+        g.v[g.n] = P2V(PTE_ADDR(pgdir[PDX(a)]));
+        g.super[g.n++] = 1;
+        pgdir[PDX(a)] = 0;
+        a += PDSIZE - PGSIZE;
+        continue;
+      }
+      // Callers that can fail use splitsuper() first.
+      if(demote(pgdir, a) < 0)
+        panic("deallocuvm: demote");
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -270,16 +416,44 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
-      char *v = P2V(pa);
-      kfree(v);
+      g.v[g.n] = P2V(pa);
+      g.super[g.n++] = 0;
+      *pte = 0;
+    } else if(*pte & PTE_SWAP){
+      swapput(SWAPSLOT(*pte));
       *pte = 0;
     }
   }
+  freegather(p, start, a, &g);
+}
+
+// Deallocate user pages to bring the process size from oldsz to
+// newsz.  oldsz and newsz need not be page-aligned, nor does newsz
+// need to be less than oldsz.  oldsz can be larger than the actual
+// process size.  Returns the new process size.
+// pgdir must not be in use by any CPU; see shrinkuvm().
+int
+deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  if(newsz >= oldsz)
+    return oldsz;
+  unmaprange(0, pgdir, oldsz, newsz);
+  return newsz;
+}
+
+// Like deallocuvm(), for the address space of p, which
+// may be running on other CPUs. Caller holds lockvm(p).
+int
+shrinkuvm(struct proc *p, uint oldsz, uint newsz)
+{
+  if(newsz >= oldsz)
+    return oldsz;
+  unmaprange(p, p->pgdir, oldsz, newsz);
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part. The kernel part belongs to kpgdir.
 void
 freevm(pde_t *pgdir)
 {
@@ -288,7 +462,7 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -304,46 +478,913 @@ clearpteu(pde_t *pgdir, char *uva)
 {
   pte_t *pte;
 
+  if((pgdir[PDX(uva)] & PTE_PS) && demote(pgdir, (uint)uva) < 0)
+    panic("clearpteu: demote");
   pte = walkpgdir(pgdir, uva, 0);
   if(pte == 0)
     panic("clearpteu");
   *pte &= ~PTE_U;
 }
 
-// Given a parent process's page table, create a copy
-// of it for a child.
+// Map the pages of [start, end) in pgdir into d too.
+// Writable pages become read-only PTE_COW pages in
+// both, unless shared is set. Paged-out pages share
+// the swap slot; each reads its own copy back.
+static int
+sharerange(pde_t *pgdir, pde_t *d, uint start, uint end, int shared)
+{
+  pte_t *pte, *dpte;
+  uint pa, a;
+
+  for(a = start; a < end; a += PGSIZE){
+    if((pgdir[PDX(a)] & PTE_PS) && demote(pgdir, a) < 0)
+      return -1;
+    if((pte = walkpgdir(pgdir, (void *) a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_SWAP){
+      if((dpte = walkpgdir(d, (void*)a, 1)) == 0)
+        return -1;
+      *dpte = *pte;
+      swapdup(SWAPSLOT(*pte));
+      continue;
+    }
+    if(!(*pte & PTE_P))
+      continue;
+    if(!shared && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    pa = PTE_ADDR(*pte);
+    if(mappages(d, (void*)a, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
+      return -1;
+    kshare(P2V(pa));
+  }
+  return 0;
+}
+
+// Given a parent process, create a copy of its page
+// table for a child. Pages are shared, not copied:
+// writable ones become read-only PTE_COW pages in both
+// page tables, and are copied by pagefault() on the first
+// write. MAP_SHARED mappings stay shared. Pages never
+// touched stay unmapped in both.
+// p must be the current process.
 pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+copyuvm(struct proc *p)
 {
   pde_t *d;
-  pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
+  struct vma *v;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
+  if(sharerange(p->pgdir, d, 0, p->sz, 0) < 0)
+    goto bad;
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if((v->flags & VMA_USED) && v->start >= MMAPBASE &&
+       sharerange(p->pgdir, d, v->start, v->end, v->flags & VMA_SHARED) < 0)
       goto bad;
-    }
-  }
+  tlbshoot(p, 0, KERNBASE);  // flush the write permissions just taken away
   return d;
 
 bad:
+  tlbshoot(p, 0, KERNBASE);
   freevm(d);
   return 0;
 }
 
+// Give the process its own writable copy of the
+// copy-on-write page at va mapped by pte. p is the
+// process if its page table may be in use, or 0.
+static int
+cowcopy(struct proc *p, uint va, pte_t *pte)
+{
+  uint pa;
+  char *mem;
+
+  pa = PTE_ADDR(*pte);
+  if(kshared(P2V(pa))){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, P2V(pa), PGSIZE);
+    *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+    // Other CPUs must not go on reading the old page.
+    if(p)
+      tlbshoot(p, va, va + PGSIZE);
+    kfree(P2V(pa));
+  } else {
+    // The other sharers are gone; take the page over.
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+    if(p)
+      invlpg((char*)va);
+  }
+  return 0;
+}
+
+// Map a zeroed page at va, below sz but not touched before.
+static int
+lazyalloc(pde_t *pgdir, uint va)
+{
+  char *mem;
+
+  if((mem = kzalloc()) == 0)
+    return -1;
+  if(mappages(pgdir, (char*)PGROUNDDOWN(va), PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Find the area of p containing va.
+struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if((v->flags & VMA_USED) && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Find an area of p overlapping [start, end).
+static struct vma*
+overlapvma(struct proc *p, uint start, uint end)
+{
+  struct vma *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if((v->flags & VMA_USED) && start < v->end && v->start < end)
+      return v;
+  return 0;
+}
+
+// Can the aligned 4MB piece of p around va take one 4MB
+// page? It must lie within the heap or one anonymous area,
+// overlap no other area and have nothing mapped yet. If so,
+// sets *perm to the page's permissions.
+// Caller must hold lockvm(p).
+static int
+superfits(struct proc *p, uint va, int *perm)
+{
+  uint base, start, end;
+  struct vma *v, *o;
+
+  base = va & ~(PDSIZE-1);
+  if(p->pgdir[PDX(base)] != 0)
+    return 0;
+  if((v = findvma(p, va)) != 0){
+    if(v->ip || v->shm)
+      return 0;
+    start = v->start;
+    end = v->end;
+    *perm = PTE_U | (v->flags & VMA_WRITE ? PTE_W : 0);
+  } else if(va < p->sz){
+    start = 0;
+    end = p->sz;
+    *perm = PTE_W | PTE_U;
+  } else
+    return 0;
+  if(base < start || base + PDSIZE > end)
+    return 0;
+  if((o = overlapvma(p, base, base + PDSIZE)) != 0 && o != v)
+    return 0;
+  return 1;
+}
+
+// Map the 4MB piece of p around va, which superfits()
+// allowed with perm, with one zeroed 4MB page. Allocating
+// and zeroing it takes long, so it happens without
+// lockvm(p), and the piece is checked again after.
+// Returns 0 on success; on -1 the caller maps a 4KB page.
+static int
+superfault(struct proc *p, uint va, int perm)
+{
+  char *mem;
+  int nperm;
+
+  if((mem = kalloc_pages(SUPERORDER)) == 0)
+    return -1;
+  memset(mem, 0, PDSIZE);
+
+  lockvm(p);
+  if(!superfits(p, va, &nperm) || nperm != perm){
+    unlockvm(p);
+    kfree_pages(mem, SUPERORDER);
+    return -1;
+  }
+  p->pgdir[PDX(va)] = V2P(mem) | perm | PTE_P | PTE_PS;
+  p->nspromote++;
+  unlockvm(p);
+  return 0;
+}
+
+// Copy the areas src to dst, taking inode references.
+void
+dupvmas(struct vma *dst, struct vma *src)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    dst[i] = src[i];
+    if(dst[i].ip)
+      idup(dst[i].ip);
+    if(dst[i].shm)
+      shmdup(dst[i].shm);
+  }
+}
+
+// Drop the areas, releasing their inodes and segments.
+// Must be called inside a transaction.
+void
+freevmas(struct vma *vmas)
+{
+  struct vma *v;
+
+  for(v = vmas; v < &vmas[NVMA]; v++){
+    if(v->ip)
+      iput(v->ip);
+    if(v->shm)
+      shmput(v->shm);
+    memset(v, 0, sizeof(*v));
+  }
+}
+
+// Cut the program segments of p back to size sz, so that
+// memory grown again later above sz reads as zero.
+void
+trimvmas(struct proc *p, uint sz)
+{
+  struct vma *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+    if(!(v->flags & VMA_USED) || v->start >= MMAPBASE || v->end <= sz)
+      continue;
+    if(sz <= v->start){
+      v->end = v->start;
+      v->filesz = 0;
+      continue;
+    }
+    v->end = PGROUNDUP(sz);
+    if(v->filesz > sz - v->start)
+      v->filesz = sz - v->start;
+  }
+}
+
+// Can the current kernel code sleep, holding no spinlocks?
+static int
+cansleep(void)
+{
+  int r;
+
+  pushcli();
+  r = mycpu()->ncli == 1;
+  popcli();
+  return r;
+}
+
+// Read the page at va of area v into mem, which is zeroed.
+static int
+vmaload(struct vma *v, uint va, char *mem)
+{
+  uint pos, n;
+  int r;
+
+  pos = va - v->start;
+  if(v->ip == 0 || pos >= v->filesz)
+    return 0;
+  n = v->filesz - pos;
+  if(n > PGSIZE)
+    n = PGSIZE;
+
+  // readi() sleeps; a fault from code holding a spinlock
+  // can't be served. See prefault().
+  if(!cansleep())
+    return -1;
+  ilock(v->ip);
+  r = readi(v->ip, mem, v->off + pos, n);
+  iunlock(v->ip);
+  return r == n ? 0 : -1;
+}
+
+// Page in va of p from a copy of its area v.
+static int
+vmafault(struct proc *p, struct vma *v, uint va)
+{
+  pte_t *pte;
+  char *mem;
+  int r;
+
+  va = PGROUNDDOWN(va);
+  if((mem = kzalloc()) == 0)
+    return -1;
+  if(vmaload(v, va, mem) < 0){
+    kfree(mem);
+    return -1;
+  }
+
+  lockvm(p);
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_P)){
+    kfree(mem);  // another thread got here first
+    r = 0;
+  } else if((r = mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem),
+                          PTE_U | (v->flags & VMA_WRITE ? PTE_W : 0))) < 0){
+    kfree(mem);
+  }
+  unlockvm(p);
+
+  if(r == 0)
+    invlpg((char*)va);
+  return r;
+}
+
+// Map page va of shared memory area v into p.
+// Caller must hold lockvm(p).
+static int
+shmfault(struct proc *p, struct vma *v, uint va)
+{
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  mem = shmpage(v->shm, (va - v->start) / PGSIZE);
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0)
+    return -1;
+  kshare(mem);
+  return 0;
+}
+
+// Read the page at va of p back from swap, into a
+// copy of its own.
+static int
+swapfault(struct proc *p, uint va)
+{
+  pte_t *pte, old;
+  uint flags;
+  char *mem;
+
+  // Reading the slot sleeps; see vmaload().
+  if(!cansleep())
+    return -1;
+  va = PGROUNDDOWN(va);
+  lockvm(p);
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte == 0 || !(*pte & PTE_SWAP)){
+    unlockvm(p);
+    return 0;  // another thread got here first
+  }
+  old = *pte;
+  swapdup(SWAPSLOT(old));  // keep the slot while reading it
+  unlockvm(p);
+
+  if((mem = kalloc()) == 0){
+    swapput(SWAPSLOT(old));
+    return -1;
+  }
+  swapread(SWAPSLOT(old), mem);
+
+  lockvm(p);
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte && *pte == old){
+    flags = PTE_FLAGS(old) & (PTE_W|PTE_U|PTE_COW);
+    if(flags & PTE_COW)
+      flags = (flags & ~PTE_COW) | PTE_W;
+    // PTE_A gives the page a round before it can go again;
+    // PTE_D keeps uvmevict() from dropping it as clean.
+    *pte = V2P(mem) | flags | PTE_P | PTE_A | PTE_D;
+    swapput(SWAPSLOT(old));
+    p->nswapin++;
+    mem = 0;
+  }
+  unlockvm(p);
+
+  swapput(SWAPSLOT(old));
+  if(mem)
+    kfree(mem);
+  invlpg((char*)va);
+  return 0;
+}
+
+// Page in the demand-paged areas and paged-out pages in
+// [va, va+n) of the current process, which the kernel is
+// about to access, maybe while holding spinlocks. Called
+// when system calls fetch their arguments.
+int
+prefault(uint va, uint n)
+{
+  struct proc *curproc = myproc();
+  struct vma *v, copy;
+  pte_t *pte;
+  uint a;
+  int swapped;
+
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    lockvm(curproc);
+    pte = walkpgdir(curproc->pgdir, (char*)a, 0);
+    v = 0;
+    swapped = pte && (*pte & PTE_SWAP);
+    if(!swapped && (pte == 0 || !(*pte & PTE_P)) &&
+       (v = findvma(curproc, a)) != 0){
+      if(v->shm){
+        if(shmfault(curproc, v, a) < 0){
+          unlockvm(curproc);
+          return -1;
+        }
+        v = 0;
+      } else
+        copy = *v;
+    }
+    unlockvm(curproc);
+    if(v && vmafault(curproc, &copy, a) < 0)
+      return -1;
+    if(swapped && swapfault(curproc, a) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Find room for a len byte area of p in the mmap area,
+// at addr if fixed is set, else at the lowest address that
+// fits. Returns a free slot with start and end set, or 0.
+// Caller must hold lockvm(p).
+static struct vma*
+vmaplace(struct proc *p, uint addr, uint len, int fixed)
+{
+  struct vma *v, *o;
+
+  if(len == 0 || len >= KERNBASE - MMAPBASE)
+    return 0;
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(!(v->flags & VMA_USED))
+      break;
+  if(v == &p->vmas[NVMA])
+    return 0;
+
+  if(fixed){
+    if(addr % PGSIZE || addr < MMAPBASE || addr + len > KERNBASE || addr + len < addr)
+      return 0;
+    if(overlapvma(p, addr, addr + len))
+      return 0;
+  } else {
+    addr = MMAPBASE;
+    while((o = overlapvma(p, addr, addr + len)) != 0)
+      addr = o->end;
+    if(addr + len > KERNBASE || addr + len < addr)
+      return 0;
+  }
+
+  memset(v, 0, sizeof(*v));
+  v->start = addr;
+  v->end = addr + len;
+  return v;
+}
+
+// Map len bytes of ip from offset off (of which filesz
+// bytes lie in the file) into the current process, at
+// addr if MAP_FIXED is given, else anywhere in the mmap
+// area. ip is 0 for anonymous memory; otherwise the
+// mapping takes over the caller's reference to ip.
+// Returns the address, or -1.
+int
+mmap(uint addr, uint len, int prot, int flags, struct inode *ip, uint off, uint filesz)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+
+  len = PGROUNDUP(len);
+  lockvm(curproc);
+  if((v = vmaplace(curproc, addr, len, flags & MAP_FIXED)) == 0){
+    unlockvm(curproc);
+    return -1;
+  }
+  v->flags = VMA_USED;
+  if(prot & PROT_WRITE)
+    v->flags |= VMA_WRITE;
+  if(flags & MAP_SHARED)
+    v->flags |= VMA_SHARED;
+  v->ip = ip;
+  v->off = off;
+  v->filesz = filesz < len ? filesz : len;
+  addr = v->start;
+  unlockvm(curproc);
+  return addr;
+}
+
+// Attach shared memory segment s to the current process
+// at addr, or anywhere in the mmap area if addr is 0.
+// The mapping takes over the caller's reference to s.
+// Returns the address, or -1.
+int
+shmattach(struct shm *s, uint addr)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+
+  lockvm(curproc);
+  if((v = vmaplace(curproc, addr, shmsize(s), addr != 0)) == 0){
+    unlockvm(curproc);
+    return -1;
+  }
+  v->flags = VMA_USED | VMA_WRITE | VMA_SHARED;
+  v->shm = s;
+  addr = v->start;
+  unlockvm(curproc);
+  return addr;
+}
+
+// Detach the shared memory segment attached at addr
+// from the current process.
+int
+shmdetach(uint addr)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+  uint len;
+
+  lockvm(curproc);
+  v = findvma(curproc, addr);
+  if(v == 0 || v->shm == 0 || v->start != addr){
+    unlockvm(curproc);
+    return -1;
+  }
+  len = v->end - v->start;
+  unlockvm(curproc);
+  return munmap(addr, len);
+}
+
+// Write the dirty pages of writable MAP_SHARED file
+// mappings in [start, end) of the current process back
+// to the files.
+void
+msync(uint start, uint end)
+{
+  struct proc *curproc = myproc();
+  struct vma *v, copy;
+  uint a, s, e, pos, n, pa;
+  pte_t *pte;
+
+  for(v = curproc->vmas; v < &curproc->vmas[NVMA]; v++){
+    // Hold the inode in case another thread unmaps v.
+    lockvm(curproc);
+    copy = *v;
+    if(!(copy.flags & VMA_SHARED) || !(copy.flags & VMA_WRITE))
+      copy.ip = 0;
+    if(copy.ip)
+      idup(copy.ip);
+    unlockvm(curproc);
+    if(copy.ip == 0)
+      continue;
+
+    s = start > copy.start ? start : copy.start;
+    e = end < copy.end ? end : copy.end;
+    for(a = PGROUNDDOWN(s); a < e; a += PGSIZE){
+      pos = a - copy.start;
+      if(pos >= copy.filesz)
+        break;
+
+      // Take the page's dirty bit, and a reference that
+      // keeps it while it is written without the lock.
+      pa = 0;
+      lockvm(curproc);
+      pte = walkpgdir(curproc->pgdir, (char*)a, 0);
+      if(pte && (*pte & PTE_P) && (*pte & PTE_D) &&
+         !(*pte & PTE_SCRATCH)){
+        *pte &= ~PTE_D;
+        pa = PTE_ADDR(*pte);
+        kshare(P2V(pa));
+        tlbshoot(curproc, a, a + PGSIZE);
+      }
+      unlockvm(curproc);
+      if(pa == 0)
+        continue;
+
+      n = copy.filesz - pos;
+      if(n > PGSIZE)
+        n = PGSIZE;
+      begin_op();
+      ilock(copy.ip);
+      writei(copy.ip, P2V(pa), copy.off + pos, n);
+      iunlock(copy.ip);
+      end_op();
+      kfree(P2V(pa));
+    }
+
+    begin_op();
+    iput(copy.ip);
+    end_op();
+  }
+}
+
+// Remove the mappings of [addr, addr+len) from the current
+// process, writing shared file pages back first. The range
+// must lie within one mmap() mapping.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *curproc = myproc();
+  struct vma *v, *nv;
+  struct inode *drop;
+  struct shm *dropshm;
+  uint end, cut;
+
+  end = addr + PGROUNDUP(len);
+  if(addr % PGSIZE || addr < MMAPBASE || len == 0 || end < addr || end > KERNBASE)
+    return -1;
+
+  msync(addr, end);
+
+  drop = 0;
+  dropshm = 0;
+  lockvm(curproc);
+  v = findvma(curproc, addr);
+  if(v == 0 || v->start < MMAPBASE || end > v->end)
+    goto bad;
+  if(v->shm && (addr != v->start || end != v->end))
+    goto bad;  // segments are detached whole
+  if(splitsuper(curproc->pgdir, addr, end) < 0)
+    goto bad;
+
+  if(addr == v->start && end == v->end){
+    drop = v->ip;
+    dropshm = v->shm;
+    memset(v, 0, sizeof(*v));
+  } else if(addr == v->start){
+    cut = end - v->start;
+    v->start = end;
+    v->off += cut;
+    v->filesz = v->filesz > cut ? v->filesz - cut : 0;
+  } else {
+    if(end < v->end){
+      // Punching a hole: the part above it gets its own slot.
+      for(nv = curproc->vmas; nv < &curproc->vmas[NVMA]; nv++)
+        if(!(nv->flags & VMA_USED))
+          break;
+      if(nv == &curproc->vmas[NVMA])
+        goto bad;
+      cut = end - v->start;
+      *nv = *v;
+      nv->start = end;
+      nv->off += cut;
+      nv->filesz = v->filesz > cut ? v->filesz - cut : 0;
+      if(nv->ip)
+        idup(nv->ip);
+    }
+    v->end = addr;
+    if(v->filesz > addr - v->start)
+      v->filesz = addr - v->start;
+  }
+
+  shrinkuvm(curproc, end, addr);
+  unlockvm(curproc);
+
+  if(dropshm)
+    shmput(dropshm);
+  if(drop){
+    begin_op();
+    iput(drop);
+    end_op();
+  }
+  return 0;
+
+bad:
+  unlockvm(curproc);
+  return -1;
+}
+
+// Resolve a page fault at user address va of the current
+// process, from user or kernel mode. err is the fault's
+// error code. Returns 0 if the access may be retried,
+// -1 if it is invalid.
+int
+pagefault(uint va, uint err)
+{
+  struct proc *curproc = myproc();
+  struct vma *v, copy;
+  pte_t *pte;
+  int r, super, perm;
+
+  if(va >= KERNBASE)
+    return -1;
+  if(cansleep())
+    swapreclaim();
+
+  super = 1;
+again:
+  lockvm(curproc);
+  pte = walkpgdir(curproc->pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_P)){
+    if((*pte & PTE_COW) && (err & FEC_WR))
+      r = cowcopy(curproc, PGROUNDDOWN(va), pte);
+    else if((*pte & PTE_U) && ((*pte & PTE_W) || !(err & FEC_WR)))
+      r = 0;  // another thread got here first
+    else
+      r = -1;
+  } else if(pte && (*pte & PTE_SWAP)){
+    unlockvm(curproc);
+    return swapfault(curproc, va);
+  } else if((v = findvma(curproc, va)) != 0 && v->shm){
+    r = shmfault(curproc, v, va);
+  } else if(super && superfits(curproc, va, &perm)){
+    unlockvm(curproc);
+    if(superfault(curproc, va, perm) == 0){
+      invlpg((char*)PGROUNDDOWN(va));
+      return 0;
+    }
+    // Start over with 4KB pages; the lock was dropped.
+    super = 0;
+    goto again;
+  } else if(v){
+    // Reading the file may sleep; drop the lock.
+    copy = *v;
+    unlockvm(curproc);
+    return vmafault(curproc, &copy, va);
+  } else if(va < curproc->sz){
+    r = lazyalloc(curproc->pgdir, va);
+  } else {
+    r = -1;
+  }
+  unlockvm(curproc);
+
+  if(r == 0)
+    invlpg((char*)PGROUNDDOWN(va));
+  return r;
+}
+
+// The kernel faulted on user address va in a system call
+// and pagefault() could not serve it: another thread
+// unmapped the page after prefault(), the page is
+// read-only, or memory ran out. Kill the process, and map
+// a zeroed page of its own at va so that the kernel can
+// finish the copy and return from the system call. The
+// page is PTE_SCRATCH, so msync() won't write it to a file.
+// Returns -1 if even that fails.
+int
+killfault(uint va)
+{
+  struct proc *curproc = myproc();
+  pde_t *pgdir;
+  pte_t *pte;
+  char *mem, *old;
+
+  if(va >= KERNBASE)
+    return -1;
+  curproc->killed = 1;
+  va = PGROUNDDOWN(va);
+  if((mem = kzalloc()) == 0)
+    return -1;
+
+  lockvm(curproc);
+  pgdir = curproc->pgdir;
+  if(((pgdir[PDX(va)] & PTE_PS) && demote(pgdir, va) < 0) ||
+     (pte = walkpgdir(pgdir, (char*)va, 1)) == 0){
+    unlockvm(curproc);
+    kfree(mem);
+    return -1;
+  }
+  old = 0;
+  if(*pte & PTE_P)
+    old = P2V(PTE_ADDR(*pte));
+  else if(*pte & PTE_SWAP)
+    swapput(SWAPSLOT(*pte));
+  *pte = V2P(mem) | PTE_P | PTE_W | PTE_U | PTE_SCRATCH;
+  tlbshoot(curproc, va, va + PGSIZE);
+  unlockvm(curproc);
+
+  if(old)
+    kfree(old);
+  return 0;
+}
+
+// Is va in the user stack of one of p's threads?
+static int
+isustack(struct proc *p, uint va)
+{
+  int i;
+
+  for(i = 0; i < NTHREAD; i++)
+    if(p->ustack_pool[i] && va >= p->ustack_pool[i] - PGSIZE &&
+       va < p->ustack_pool[i])
+      return 1;
+  return 0;
+}
+
+// Go on with the clock scan of p's pages for up to
+// SWAPSCAN PTEs, taking up to n pages to page out. A page
+// accessed since the last scan loses PTE_A and stays; a
+// clean page of a file mapping is dropped, to be read
+// from the file again; any other page gets a swap slot
+// from slot, which replaces it in the PTE. Pages shared
+// with other processes, MAP_SHARED mappings, user stacks
+// and 4MB pages stay. slot holds n free slots; returns
+// the number k of pages to write out, put in mem, to the
+// first k slots. Caller must hold lockvm(p), and p must
+// not be running, so that no TLB holds its PTEs.
+int
+uvmevict(struct proc *p, char **mem, uint *slot, int n)
+{
+  pde_t pde;
+  pte_t *pte;
+  struct vma *v;
+  uint va, pa, i;
+  int k;
+
+  k = 0;
+  va = p->swaphand;
+  for(i = 0; i < SWAPSCAN; i++, va += PGSIZE){
+    if(va >= KERNBASE)
+      va = 0;
+    pde = p->pgdir[PDX(va)];
+    if(!(pde & PTE_P) || (pde & PTE_PS)){
+      va = PGADDR(PDX(va) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    pte = walkpgdir(p->pgdir, (char*)va, 0);
+    if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    pa = PTE_ADDR(*pte);
+    if(kshared(P2V(pa)) || isustack(p, va))
+      continue;
+    v = findvma(p, va);
+    if(v && (v->flags & VMA_SHARED))
+      continue;
+    if(v && v->ip && !(*pte & PTE_D)){
+      *pte = 0;
+      kfree(P2V(pa));
+      continue;
+    }
+    if(k == n)
+      break;
+    *pte = (slot[k] << PTXSHIFT) | PTE_SWAP | (*pte & (PTE_W|PTE_U|PTE_COW));
+    mem[k++] = P2V(pa);
+  }
+  p->swaphand = va;
+  p->nswapout += k;
+  return k;
+}
+
+// Count the pages mapped by p into pm, by the part of
+// memory they belong to. Unlocked, so the counts may be
+// off while p changes its memory.
+void
+uvmstat(struct proc *p, struct procmem *pm)
+{
+  pde_t *pgdir, pde;
+  pte_t *pgtab;
+  uint i, j, va;
+
+  pm->text = pm->heap = pm->stack = pm->mmap = pm->swap = 0;
+  pm->pgtab = 1;
+  pgdir = p->pgdir;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    pde = pgdir[i];
+    if(!(pde & PTE_P) || PTE_ADDR(pde) >= PHYSTOP)
+      continue;
+    va = PGADDR(i, 0, 0);
+    if(pde & PTE_PS){
+      if(va >= MMAPBASE)
+        pm->mmap += NPTENTRIES;
+      else
+        pm->heap += NPTENTRIES;
+      continue;
+    }
+    pm->pgtab++;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pde));
+    for(j = 0; j < NPTENTRIES; j++){
+      if(pgtab[j] & PTE_SWAP)
+        pm->swap++;
+      if(!(pgtab[j] & PTE_P))
+        continue;
+      va = PGADDR(i, j, 0);
+      if(va >= MMAPBASE)
+        pm->mmap++;
+      else if(findvma(p, va))
+        pm->text++;
+      else if(isustack(p, va))
+        pm->stack++;
+      else
+        pm->heap++;
+    }
+  }
+}
+
+// Return the page table pages of the kernel half,
+// shared by all page tables, counting kpgdir itself.
+uint
+kvmpages(void)
+{
+  uint i, n;
+
+  n = 1;
+  for(i = PDX(KERNBASE); i < NPDENTRIES; i++)
+    if((kpgdir[i] & PTE_P) && !(kpgdir[i] & PTE_PS))
+      n++;
+  return n;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -356,6 +1397,8 @@ uva2ka(pde_t *pgdir, char *uva)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
+  if(*pte & PTE_PS)
+    return (char*)P2V(PTE_ADDR(*pte) + ((uint)uva & (PDSIZE-1) & ~(PGSIZE-1)));
   return (char*)P2V(PTE_ADDR(*pte));
 }
 
@@ -367,10 +1410,17 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    // Writes through the kernel mapping bypass PTE_COW.
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_P) && (*pte & PTE_COW)){
+      if(cowcopy(pgdir == myproc()->pgdir ? myproc() : 0, va0, pte) < 0)
+        return -1;
+    }
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;